@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Band-limited resampling of a signal made of steps. Whoever produces the
+// signal adds a delta wherever its level changes, at the clock tick it
+// changes; each delta is spread over a few output samples as a windowed
+// sinc step, so edges far above the output rate do not alias back down as
+// they would if the signal were sampled. Reading integrates the deltas into
+// samples and takes off the DC with a gentle high-pass, like the capacitor
+// on a real output.
+//
+// Time runs in frames: deltas are timed from the start of the current one
+// and ending it makes the samples before its end readable.
+class BlipBuffer {
+    public:
+        // Output samples each step is spread over, which is also about twice
+        // the latency it adds.
+        static constexpr unsigned TAPS = 16;
+        // Longest frame, in output samples.
+        static constexpr size_t FRAME_SAMPLES = 256;
+
+        // Holds up to capacity samples not yet read.
+        explicit BlipBuffer(size_t capacity);
+
+        // Output samples per clock tick. Takes effect from the current frame.
+        void setRates(double clockRate, double sampleRate);
+        double sampleRate() const { return outputRate; }
+
+        // Adds delta (in 16 bit sample units) to the level from time on.
+        void addDelta(uint64_t time, int32_t delta) {
+            uint64_t position = offset + time * factor;
+            size_t index = size_t(position >> FRACTION_BITS);
+            if (index >= deltas.size() - TAPS) return;
+            const int16_t *kernel = table[position >> (FRACTION_BITS - PHASE_BITS) & (PHASES - 1)];
+            int32_t *out = deltas.data() + index;
+            for (unsigned tap = 0; tap < TAPS; ++tap) out[tap] += kernel[tap] * delta;
+        }
+        // Ends the frame at time; the next one starts there. Past capacity
+        // the oldest samples are dropped, and their number returned.
+        size_t endFrame(uint64_t time);
+
+        size_t samplesAvailable() const { return size_t(offset >> FRACTION_BITS); }
+        size_t capacity() const { return limit; }
+        // Reads up to count samples into out, stride samples apart, and
+        // returns how many. Without out they are dropped.
+        size_t read(int16_t *out, size_t count, size_t stride = 1);
+        void clear();
+
+    private:
+        static constexpr unsigned FRACTION_BITS = 32;
+        static constexpr unsigned PHASE_BITS = 6;
+        static constexpr unsigned PHASES = 1 << PHASE_BITS;
+        // Each phase of the kernel sums to 1 << KERNEL_BITS.
+        static constexpr unsigned KERNEL_BITS = 15;
+        // Cutoff of the high-pass: about 15 Hz at 48 kHz.
+        static constexpr unsigned BASS_SHIFT = 9;
+
+        using Kernel = int16_t[TAPS];
+        static const Kernel *kernels();
+
+        const Kernel *table = kernels();
+        size_t limit;
+        double outputRate = 0;
+        // Output samples per tick and the start of the frame, counted from
+        // the first unread sample, both with FRACTION_BITS of fraction.
+        uint64_t factor = 0;
+        uint64_t offset = 0;
+        std::vector<int32_t> deltas;
+        int32_t integrator = 0;
+};
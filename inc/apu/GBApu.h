@@ -0,0 +1,102 @@
+#pragma once
+
+#include <apu/BlipBuffer.h>
+#include <memory/GBMemory.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// DMG sound: two square channels, the first with a frequency sweep, a wave
+// channel and a noise channel, mixed to stereo through NR50 and NR51.
+//
+// The APU catches up when run. It replays the bus's log of sound register
+// writes (see GBMEM's sound section) at the clock each was made, and in
+// between moves each channel from one edge of its waveform to the next
+// rather than cycle by cycle, putting every change of level into a
+// band-limited step buffer per side. Nothing is sampled, so nothing
+// aliases, and the cost follows the notes played rather than the clock.
+//
+// Lengths, envelopes, sweep and waveform positions are the APU's own, not
+// the bus's, so save states do not hold them. Run-ahead keeps them right by
+// running the APU on the real timeline only; after a jump elsewhere (a
+// rewind, a loaded state) resync takes the channels back from the registers.
+class GBAPU {
+    public:
+        static constexpr unsigned SAMPLE_RATE = 48000;
+        // Samples are read as frames of left then right.
+        static constexpr unsigned CHANNELS = 2;
+
+        explicit GBAPU(unsigned sampleRate = SAMPLE_RATE);
+
+        // Starts following mem's sound from its registers as they are.
+        void attach(GBMEM &mem);
+        // Takes the channels from the registers: the ones NR52 shows playing
+        // restart their note. run does this itself when the clock went back.
+        void resync(const GBMEM &mem);
+        // Plays everything up to the bus clock.
+        void run(GBMEM &mem);
+        // Sample frames per emulated second are the sample rate times ratio,
+        // for matching a host whose clocks differ (see RateControl). Takes
+        // effect from the next run.
+        void setResampleRatio(double ratio);
+        double resampleRatio() const { return stretch; }
+
+        // Sample frames ready to read. Two seconds are kept; past that the
+        // oldest are dropped.
+        size_t samplesAvailable() const { return left.samplesAvailable(); }
+        size_t readSamples(int16_t *out, size_t frames);
+        uint64_t samplesDropped() const { return dropped; }
+
+    private:
+        struct Channel {
+            bool on = false;
+            bool dac = false;
+            bool lengthEnabled = false;
+            uint16_t length = 0;
+            // 11 bits from NRx3 and NRx4; unused by the noise channel.
+            uint16_t frequency = 0;
+            // Tick of the next waveform step: duty step, wave sample or
+            // noise shift.
+            uint64_t nextEdge = 0;
+            uint8_t position = 0;
+            uint8_t volume = 0;
+            uint8_t envelopePeriod = 0;
+            uint8_t envelopeTimer = 0;
+            bool envelopeUp = false;
+            // What the channel adds to each side now.
+            int32_t left = 0;
+            int32_t right = 0;
+        };
+
+        void advance(uint64_t to);
+        void runChannel(unsigned n, uint64_t to);
+        void clockSequencer(unsigned step, uint64_t time);
+        void clockSweep(uint64_t time);
+        void write(unsigned reg, uint8_t data, uint64_t time);
+        void trigger(unsigned n, uint64_t time);
+        uint64_t period(unsigned n) const;
+        uint16_t sweepTarget() const;
+        uint8_t level(unsigned n) const;
+        void output(unsigned n, uint64_t time);
+        void endFrame();
+
+        // FF10-FF3F as last written.
+        std::array<uint8_t, 0x30> regs{};
+        std::array<Channel, 4> channels{};
+        uint16_t sweepFrequency = 0;
+        uint8_t sweepTimer = 8;
+        bool sweepEnabled = false;
+        uint16_t lfsr = 0x7FFF;
+
+        // In ticks, four to the M-cycle: how far the channels have run and
+        // where the step buffers' frame started.
+        uint64_t now = 0;
+        uint64_t frameStart = 0;
+        unsigned rate;
+        double stretch = 1;
+        BlipBuffer left;
+        BlipBuffer right;
+        uint64_t dropped = 0;
+        std::vector<GBMEM::SoundWrite> writes;
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstddef>
+
+// Dynamic rate control. The frontend paces the emulation at 59.73 Hz on the
+// host's timer clock, and the audio device drains at its own clock, which
+// never quite agrees with it, so a queue between them slowly fills or runs
+// dry. Instead of dropping or repeating frames, the APU's
+// resampling ratio is nudged each frame to steer the queue back to a target
+// fill: proportionally to how far off it is, plus an integral term that
+// takes up the steady difference between the clocks so the queue settles
+// on the target rather than beside it. The ratio never moves more than
+// maxDeviation from 1; at 0.5% the pitch change is under 9 cents.
+class RateControl {
+    public:
+        static constexpr double MAX_DEVIATION = 0.005;
+
+        explicit RateControl(size_t targetFrames, double maxDeviation = MAX_DEVIATION);
+
+        void setTarget(size_t frames) { goal = frames; }
+        size_t target() const { return goal; }
+
+        // Takes how many sample frames are queued for the device now and
+        // returns the ratio to produce the next frame's sound with.
+        double update(size_t queued);
+        double ratio() const { return current; }
+        // The queue level the ratio was worked out from, smoothed over the
+        // device's bursty reads.
+        double level() const { return smoothed; }
+        void reset();
+
+    private:
+        size_t goal;
+        double deviation;
+        double smoothed = -1;
+        double integral = 0;
+        double current = 1;
+};
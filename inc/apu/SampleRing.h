@@ -0,0 +1,45 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Stereo samples on their way from the emulation to the audio device. One
+// thread writes and one reads, and neither ever waits for the other: each
+// side owns its own index and only reads the other's, so there is no lock
+// and every call finishes in a bounded number of steps. A write that does
+// not fit and a read of more than is there just do less.
+class SampleRing {
+    public:
+        static constexpr unsigned CHANNELS = 2;
+
+        // Room for at least frames sample frames (rounded up to a power of
+        // two).
+        explicit SampleRing(size_t frames);
+
+        // Producer side. Returns the frames written.
+        size_t write(const int16_t *samples, size_t frames);
+        // Consumer side. Returns the frames read.
+        size_t read(int16_t *samples, size_t frames);
+
+        // Frames waiting, as of some moment during the call; exact from
+        // either side when the other is idle.
+        size_t available() const {
+            size_t read = tail.load(std::memory_order_acquire);
+            return head.load(std::memory_order_acquire) - read;
+        }
+        size_t capacity() const { return mask + 1; }
+
+    private:
+        std::vector<int16_t> buffer;
+        size_t mask;
+        // Free running frame counts, each written only by its own side and
+        // on its own cache line so the two sides do not bounce one between
+        // them. Each side also keeps the last value it saw of the other's
+        // and only reloads it when that is not enough.
+        alignas(64) std::atomic<size_t> head{0};
+        size_t tailSeen = 0;
+        alignas(64) std::atomic<size_t> tail{0};
+        size_t headSeen = 0;
+};
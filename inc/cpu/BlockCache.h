@@ -0,0 +1,87 @@
+#pragma once
+
+#include <memory/GBMemory.h>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+class GBCPU;
+
+// A straight run of predecoded instructions ending at the first control
+// transfer. Keyed by start address and the bank mapped there.
+struct Block {
+    using Handler = uint16_t(GBCPU::*)(GBMEM&, uint16_t);
+    using Native = uint16_t(*)(GBCPU*, GBMEM*);
+
+    struct Entry {
+        Handler handler;   // already resolved through the CB table for CB ops
+        uint16_t address;  // what the handler expects (CB: the second byte)
+        uint16_t next;     // fall-through PC
+        uint8_t opcode;
+    };
+
+    uint16_t start = 0;
+    uint16_t end = 0;      // one past the last byte
+    uint16_t bank = 0;
+    uint32_t cycles = 0;   // not-taken cost of the whole block
+    std::vector<Entry> entries;
+
+    // Set by the Dynarec once the block is hot. nativeBody skips the
+    // prologue and is where linked blocks jump to.
+    Native native = nullptr;
+    const uint8_t *nativeBody = nullptr;
+    uint16_t heat = 0;
+    bool interpretOnly = false;
+};
+
+class BlockCache {
+    public:
+        static constexpr size_t MAX_BLOCK_INSTRUCTIONS = 32;
+
+        Block *find(const GBMEM &mem, uint16_t address) {
+            Block *block = lookup(address);
+            uint16_t bank = mem.bankOf(address);
+            if (block && block->bank == bank) return block;
+            return refind(address, bank);
+        }
+
+        // Exact lookup that ignores what is currently mapped.
+        Block *get(uint16_t bank, uint16_t address) const {
+            auto it = blocks.find(key(bank, address));
+            return it == blocks.end() ? nullptr : it->second.get();
+        }
+
+        // Takes ownership and marks the block's pages as code in mem.
+        Block *insert(GBMEM &mem, std::unique_ptr<Block> block);
+
+        // Drops every block on a page written since the last sync. Must
+        // not be called while a block is executing.
+        void sync(GBMEM &mem);
+
+        void clear();
+        size_t size() const { return blocks.size(); }
+        uint64_t invalidations() const { return invalidated; }
+        uint64_t nativeInvalidations() const { return nativeInvalidated; }
+
+    private:
+        static uint32_t key(uint16_t bank, uint16_t address) { return (uint32_t(bank) << 16) | address; }
+
+        Block *&lookup(uint16_t address) {
+            auto &page = fastLookup[address >> 8];
+            if (!page) page = std::make_unique<std::array<Block*, 256>>();
+            return (*page)[address & 0xFF];
+        }
+
+        Block *refind(uint16_t address, uint16_t bank);
+        void invalidatePage(uint8_t page);
+
+        std::unordered_map<uint32_t, std::unique_ptr<Block>> blocks;
+        // Most recently used block per address, allocated per 256 byte page.
+        std::array<std::unique_ptr<std::array<Block*, 256>>, 256> fastLookup;
+        std::array<std::vector<Block*>, 256> pageBlocks;
+        uint64_t invalidated = 0;
+        uint64_t nativeInvalidated = 0;
+        uint32_t syncedWrites = 0;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cpu/BlockCache.h>
+#include <memory/GBMemory.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <vector>
+
+class GBCPU;
+
+#if defined(__x86_64__) && defined(__unix__)
+#define GB_DYNAREC_X64 1
+#else
+#define GB_DYNAREC_X64 0
+#endif
+
+// Translates hot predecoded blocks into x86-64 code. Simple register moves,
+// loads of immediates and jumps are emitted inline; everything else becomes
+// a direct call into the per-opcode handler, so semantics are shared with
+// the interpreters. Only ROM blocks that do not touch I/O registers are
+// translated: code in RAM can be rewritten at any time and stays with the
+// block interpreter.
+//
+// Generated block signature: uint16_t (GBCPU*, GBMEM*), returning the next
+// PC. Exits to a known target jump straight into the target's code while
+// the CPU's cycle count is below its runUntil.
+class Dynarec {
+    public:
+        static constexpr bool available = GB_DYNAREC_X64;
+        static constexpr size_t CODE_CACHE_SIZE = 4 << 20;
+        // Executions in the block interpreter before a block is translated.
+        static constexpr uint16_t HOT_THRESHOLD = 8;
+
+        Dynarec();
+        ~Dynarec();
+        Dynarec(const Dynarec &) = delete;
+        Dynarec &operator=(const Dynarec &) = delete;
+
+        // Emits native code for block. False if it has to stay interpreted
+        // (in which case it is not offered again) or the code cache is
+        // exhausted.
+        bool translate(const GBCPU &cpu, const GBMEM &mem, BlockCache &cache, Block &block);
+
+        // When the code cache is full every block has to be dropped with
+        // it; the caller clears its BlockCache and then calls flush().
+        bool exhausted() const { return full; }
+        void flush();
+
+        // Re-resolves block links after translated blocks were invalidated
+        // or 0000-3FFF changed bank.
+        void sync(BlockCache &cache, const GBMEM &mem);
+
+        // Lockstep validation: a shadow CPU and memory replay everything
+        // through the table interpreter and are compared after every
+        // translated block. Blocks translated while it is on are not
+        // linked, so it is set before running.
+        void setLockstep(bool enable);
+        bool lockstepEnabled() const { return lockstep; }
+        void beginLockstep(const GBCPU &cpu, const GBMEM &mem);
+        bool checkLockstep(const GBCPU &cpu, const GBMEM &mem, uint16_t address);
+        bool lockstepActive() const { return shadow != nullptr; }
+        // Drops the shadow so the next run starts it from the current state.
+        void endLockstep();
+
+        size_t translated() const { return translatedBlocks; }
+        size_t rejected() const { return rejectedBlocks; }
+        size_t links() const { return linkSlots.size(); }
+        size_t codeBytes() const { return size_t(cursor - code); }
+        uint64_t flushes() const { return flushCount; }
+        uint64_t lockstepChecks() const { return checks; }
+        uint64_t lockstepMismatches() const { return mismatches; }
+
+    private:
+        struct Link {
+            uint16_t bank;
+            uint16_t target;
+            const uint8_t **slot;
+        };
+
+        struct Shadow;
+
+        bool allocate();
+        bool protect(uint8_t *from, bool writable);
+        const uint8_t *resolve(BlockCache &cache, uint16_t bank, uint16_t target);
+
+        uint8_t *code = nullptr;
+        uint8_t *cursor = nullptr;
+        bool full = false;
+        bool unavailable = false;
+
+        // Slots hold the body address of a link target, or null while it
+        // is not translated. A deque keeps their addresses stable.
+        std::deque<const uint8_t*> linkSlots;
+        std::vector<Link> linkList;
+        uint64_t syncedInvalidations = 0;
+        uint32_t syncedBankGeneration = 0;
+
+        size_t translatedBlocks = 0;
+        size_t rejectedBlocks = 0;
+        uint64_t flushCount = 0;
+
+        bool lockstep = false;
+        std::unique_ptr<Shadow> shadow;
+        uint64_t checks = 0;
+        uint64_t mismatches = 0;
+};
@@ -1,8 +1,12 @@
 #pragma once
 
 #include <cstdint>
+#include <cpu/BlockCache.h>
+#include <cpu/Dynarec.h>
 #include <memory/GBMemory.h>
+#include <utils/trace.h>
 #include <array>
+#include <utility>
 
 class GBCPU {
       public:
@@ -17,49 +21,63 @@ class GBCPU {
             static const uint8_t c = 1 << 4;
 
             // GETTERS
-            uint8_t A() const { return af & 0xFF00; }
-            uint8_t F() const { return af & 0x00FF; }
-            uint8_t B() const { return bc & 0xFF00; }
+            // F is not stored eagerly, see flags().
+            uint8_t A() const { return af >> 8; }
+            uint8_t F() const { return flags(); }
+            uint8_t B() const { return bc >> 8; }
             uint8_t C() const { return bc & 0x00FF; }
-            uint8_t D() const { return de & 0xFF00; }
+            uint8_t D() const { return de >> 8; }
             uint8_t E() const { return de & 0x00FF; }
-            uint8_t H() const { return hl & 0xFF00; }
+            uint8_t H() const { return hl >> 8; }
             uint8_t L() const { return hl & 0x00FF; }
 
-            uint16_t AF() const { return af; }
+            uint16_t AF() const { return (af & 0xFF00) | flags(); }
             uint16_t BC() const { return bc; }
             uint16_t DE() const { return de; }
             uint16_t HL() const { return hl; }
+            uint16_t SP() const { return sp; }
+            uint16_t PC() const { return pc; }
 
             // SETTERS
-            void A(const uint8_t & val) { af = af & 0x00FF + val << 8; }
-            void F(const uint8_t & val) { af = af & 0xFF00 + val; }
-            void B(const uint8_t & val) { bc = bc & 0x00FF + val << 8; }
-            void C(const uint8_t & val) { bc = bc & 0xFF00 + val; }
-            void D(const uint8_t & val) { de = de & 0x00FF + val << 8; }
-            void E(const uint8_t & val) { de = de & 0xFF00 + val; }
-            void H(const uint8_t & val) { hl = hl & 0x00FF + val << 8; }
-            void L(const uint8_t & val) { hl = hl & 0xFF00 + val; }
-
-            void AF(const uint16_t & val) { af = val; }
+            void A(const uint8_t & val) { af = (af & 0x00FF) | (val << 8); }
+            void F(const uint8_t & val) { setFlags(val); }
+            void B(const uint8_t & val) { bc = (bc & 0x00FF) | (val << 8); }
+            void C(const uint8_t & val) { bc = (bc & 0xFF00) | val; }
+            void D(const uint8_t & val) { de = (de & 0x00FF) | (val << 8); }
+            void E(const uint8_t & val) { de = (de & 0xFF00) | val; }
+            void H(const uint8_t & val) { hl = (hl & 0x00FF) | (val << 8); }
+            void L(const uint8_t & val) { hl = (hl & 0xFF00) | val; }
+
+            void AF(const uint16_t & val) { af = val & 0xFF00; setFlags(val); }
             void BC(const uint16_t & val) { bc = val; }
             void DE(const uint16_t & val) { de = val; }
             void HL(const uint16_t & val) { hl = val; }
+            void SP(const uint16_t & val) { sp = val; }
+            void PC(const uint16_t & val) { pc = val; }
+
+            // Z and C are what conditions and carry-in ops read, so they
+            // are derived directly instead of through flags().
+            bool hasZ() const {
+                if (flagOp == FlagOp::Known || flagOp == FlagOp::AddHL) return flagBase & z;
+                return (flagResult & 0xFF) == 0;
+            }
+            bool hasN() const { return flags() & n; }
+            bool hasH() const { return flags() & h; }
+            bool hasC() const {
+                if (flagOp == FlagOp::Add || flagOp == FlagOp::Sub) return flagResult > 0xFF;
+                if (flagOp == FlagOp::AddHL) return flagResult > 0xFFFF;
+                return flagBase & c;
+            }
 
-            bool hasZ() { return af & z; }
-            bool hasN() { return af & n; }
-            bool hasH() { return af & h; }
-            bool hasC() { return af & c; }
-
-            bool setZ() { return af | z; }
-            bool setN() { return af | n; }
-            bool setH() { return af | h; }
-            bool setC() { return af | c; }
+            void setZ() { setFlags(flags() | z); }
+            void setN() { setFlags(flags() | n); }
+            void setH() { setFlags(flags() | h); }
+            void setC() { setFlags(flags() | c); }
 
-            bool unSetZ() { return af & ~z; }
-            bool unSetN() { return af & ~n; }
-            bool unSetH() { return af & ~h; }
-            bool unSetC() { return af & ~c; }
+            void unSetZ() { setFlags(flags() & ~z); }
+            void unSetN() { setFlags(flags() & ~n); }
+            void unSetH() { setFlags(flags() & ~h); }
+            void unSetC() { setFlags(flags() & ~c); }
 
             enum FLAG {
                 f_Z, f_N, f_H, f_C
@@ -69,60 +87,268 @@ class GBCPU {
                 switch (f) {
                     case f_Z: 
                         if (state) setZ(); else unSetZ();
+                        break;
                     case f_N: 
                         if (state) setN(); else unSetN();
+                        break;
                     case f_H: 
                         if (state) setH(); else unSetH();
+                        break;
                     case f_C: 
                         if (state) setC(); else unSetC();
+                        break;
                 }
             }
+
+            // Materializes F from the last flag-setting operation.
+            uint8_t flags() const {
+                uint8_t zero = (flagResult & 0xFF) == 0 ? z : 0;
+                uint8_t half = (flagLhs ^ flagRhs ^ flagResult) & 0x10 ? h : 0;
+                switch (flagOp) {
+                    case FlagOp::Known: return flagBase;
+                    case FlagOp::Logic: return flagBase | zero;
+                    case FlagOp::Add:
+                    case FlagOp::Sub: return flagBase | zero | half | (flagResult > 0xFF ? c : 0);
+                    case FlagOp::Inc:
+                    case FlagOp::Dec: return flagBase | zero | half;
+                    case FlagOp::AddHL:
+                        return flagBase | ((flagLhs ^ flagRhs ^ flagResult) & 0x1000 ? h : 0) |
+                               (flagResult > 0xFFFF ? c : 0);
+                }
+                return flagBase;
+            }
           
+            // CLOCK
+            // Everything is counted in M-cycles (4 T-states each).
+            static constexpr uint64_t CYCLES_PER_SECOND = 1048576;
+            static constexpr uint64_t CYCLES_PER_FRAME = 17556;
+
+            // Total M-cycles executed since power on. Every handler adds its
+            // own cost, including the taken/not taken branch variants.
+            uint64_t cycleCount() const { return cycles; }
+            uint64_t instructionCount() const { return instructions; }
+            uint64_t interruptCount() const { return interrupts; }
+            // M-cycles the clock jumped over instead of executing them:
+            // halted until the next event, or going round a polling loop
+            // that could not have seen anything change.
+            uint64_t skippedCycles() const { return skipped; }
+            bool isHalted() const { return halted; }
+
             uint16_t parseInstruction(GBMEM &mem, uint16_t address);
 
-            #define CBINSTS
-            #define OP(a, b) a = b,
-            enum InstMask: uint8_t {
-                #include<cpu/opcodes.def>
+            // How run() moves between instructions. Threaded uses computed
+            // goto (GCC/Clang only) so every opcode gets its own indirect
+            // jump; Table calls through decodeTable from one shared site;
+            // Block executes predecoded basic blocks from blockCache;
+            // Dynarec runs hot blocks as native code where Dynarec::available
+            // and behaves like Block elsewhere.
+            enum class Dispatch { Table, Threaded, Block, Dynarec };
+#if defined(__GNUC__)
+            static constexpr bool threadedDispatch = true;
+#else
+            static constexpr bool threadedDispatch = false;
+#endif
+            static constexpr Dispatch defaultDispatch = threadedDispatch ? Dispatch::Threaded : Dispatch::Table;
+
+            // SAVE STATE
+            // Registers, interrupt enable and clocks as one plain block for
+            // save states. F is stored materialized, so the layout does not
+            // depend on the lazy flag encoding. Caches are not state.
+            struct State {
+                uint16_t af, bc, de, hl, sp, pc;
+                uint8_t ime, imeScheduled, halted;
+                uint8_t reserved;
+                uint64_t cycles, instructions;
             };
-            #undef OP
+            void saveState(State &state) const;
+            void loadState(const State &state);
 
-            #define OP(a, b) a,
-            constexpr static std::array<InstMask, 74> instructionList = {
+            // Executes from PC until at least cycleBudget M-cycles have
+            // elapsed, running the bus's events and taking interrupts as
+            // they come due. Returns the number of M-cycles actually run.
+            uint64_t run(GBMEM &mem, uint64_t cycleBudget, Dispatch dispatch = defaultDispatch);
+
+            // Last executed instructions, oldest first. Empty unless built
+            // with GB_TRACE.
+            const CPUTrace &trace() const { return traceBuffer; }
+
+            const BlockCache &blocks() const { return blockCache; }
+            Dynarec &recompiler() { return dynarec; }
+            const Dynarec &recompiler() const { return dynarec; }
+
+            #define CBINSTS
+            #define OP(a, b, m, l) a,
+            enum Inst: uint8_t {
                 #include <cpu/opcodes.def>
+                INVALID
             };
             #undef OP
             #undef CBINSTS
 
-            using Handler = uint16_t(GBCPU::*)(GBMEM&, uint16_t);
-            #define OP(a, b) case a: return &GBCPU::handle##a;
-            constexpr static Handler mapInst(InstMask m) {
-                switch (m) {
-                    #include <cpu/opcodes.def>
+            struct OpPattern {
+                Inst inst;
+                uint8_t pattern;
+                uint8_t fixedBits;
+                uint8_t length;
+            };
+
+            #define OP(a, b, m, l) OpPattern{a, b, m, l},
+            constexpr static auto instructionList = std::to_array<OpPattern>({
+                #include <cpu/opcodes.def>
+            });
+            #undef OP
+
+            #define CBINSTS_ONLY
+            #define OP(a, b, m, l) OpPattern{a, b, m, l},
+            constexpr static auto cbInstructionList = std::to_array<OpPattern>({
+                #include <cpu/opcodes.def>
+            });
+            #undef OP
+            #undef CBINSTS_ONLY
+
+            template<size_t N>
+            constexpr static Inst decode(const std::array<OpPattern, N> &list, uint8_t opcode) {
+                for (const OpPattern &op: list) {
+                    if ((opcode & op.fixedBits) == op.pattern) return op.inst;
+                }
+                return INVALID;
+            }
+
+            // Instructions after which control may not fall through, so a
+            // predecoded block has to stop there. DI/EI/RETI/HALT/STOP also
+            // stop it so interrupt state is only ever checked between blocks.
+            constexpr static bool endsBlock(Inst inst) {
+                switch (inst) {
+                    case JRIMM8: case JRCONDIMM8: case STOP: case HALT:
+                    case RETCOND: case RET: case RETI: case JPCONDIMM16:
+                    case JPIMM16: case JPHL: case CALLCONDIMM16: case CALLIMM16:
+                    case RSTTGT3: case DI: case EI: case INVALID:
+                        return true;
+                    default:
+                        return false;
                 }
             }
-            #undef OP
 
-            constexpr static std::array<Handler, 256> makeDecodeTable() {
-                std::array<Handler, 256> table{};
-                for (int i = 0; i < 256; ++i) {
-                    bool mapped = false;
-                    for (InstMask mask: instructionList) {
-                        if ((i & mask) == mask) {
-                            table[i] = mapInst(mask);
-                            mapped = true; 
-                            break;
-                        }
-                    }
-                    if (!mapped) table[i] = &GBCPU::handleInvalid;
+            constexpr static uint8_t instLength(uint8_t opcode) {
+                for (const OpPattern &op: instructionList) {
+                    if ((opcode & op.fixedBits) == op.pattern) return op.length;
                 }
-                return table;
+                return 1;
+            }
+
+            using Handler = uint16_t(GBCPU::*)(GBMEM&, uint16_t);
+
+            // Both tables resolve every opcode to a handler instantiated for
+            // that exact opcode, so register, condition and bit fields are
+            // compile-time constants and nothing is decoded at run time.
+            #define OP(a, b, m, l) if constexpr (inst == a) return &GBCPU::handle##a<opcode>; else
+            template<uint8_t opcode>
+            constexpr static Handler mapInst() {
+                constexpr Inst inst = decode(instructionList, opcode);
+                #include <cpu/opcodes.def>
+                return &GBCPU::handleInvalid;
+            }
+
+            #define CBINSTS_ONLY
+            template<uint8_t opcode>
+            constexpr static Handler mapCBInst() {
+                constexpr Inst inst = decode(cbInstructionList, opcode);
+                #include <cpu/opcodes.def>
+                return &GBCPU::handleInvalid;
+            }
+            #undef CBINSTS_ONLY
+            #undef OP
+
+            template<size_t... opcodes>
+            constexpr static std::array<Handler, 256> makeDecodeTable(std::index_sequence<opcodes...>) {
+                return {mapInst<opcodes>()...};
+            }
+
+            template<size_t... opcodes>
+            constexpr static std::array<Handler, 256> makeCBDecodeTable(std::index_sequence<opcodes...>) {
+                return {mapCBInst<opcodes>()...};
             }
 
         private:
-            uint16_t af, bc, de, hl, SP, PC;
+            friend class Dynarec;
+
+            // The low byte of af is unused; F lives in the lazy flag state.
+            uint16_t af = 0, bc = 0, de = 0, hl = 0, sp = 0, pc = 0;
+
+            // LAZY FLAGS
+            // ALU ops record their operands and result and leave F to be
+            // worked out by whoever reads it, since most flag results are
+            // overwritten unread. Flags an op leaves alone or forces to a
+            // constant are kept in flagBase; Known means flagBase is all of
+            // F.
+            enum class FlagOp : uint8_t { Known, Add, Sub, Inc, Dec, Logic, AddHL };
+            FlagOp flagOp = FlagOp::Known;
+            uint8_t flagBase = 0;
+            uint16_t flagLhs = 0, flagRhs = 0;
+            uint32_t flagResult = 0;
+
+            void setFlags(uint8_t val) {
+                flagOp = FlagOp::Known;
+                flagBase = val & 0xF0;
+            }
+
+            void lazyFlags(FlagOp op, uint8_t base, uint16_t lhs, uint16_t rhs, uint32_t result) {
+                flagOp = op;
+                flagBase = base;
+                flagLhs = lhs;
+                flagRhs = rhs;
+                flagResult = result;
+            }
             bool IME = false;
             uint8_t IME_scheduled = 0;
+            uint64_t cycles = 0;
+            uint64_t instructions = 0;
+            uint64_t interrupts = 0;
+            uint64_t skipped = 0;
+
+            // HALT stops the CPU until an interrupt is pending, enabled by
+            // IME or not. The dispatchers run up to runUntil, the next event
+            // or the end of the budget, which the bus pulls in when a store
+            // schedules an earlier event. Nothing else can happen before
+            // it, so both HALT and a polling loop skip straight there.
+            bool halted = false;
+            uint64_t runUntil = 0;
+            void skipTo(uint64_t time) {
+                if (time <= cycles) return;
+                skipped += time - cycles;
+                cycles = time;
+            }
+            void skipPollLoop(GBMEM &mem, uint16_t head, uint16_t branch);
+
+            // The one check made between instructions.
+            GB_ALWAYS_INLINE bool interruptPending(const GBMEM &mem) const { return IME && mem.pendingInterrupts(); }
+            void takeInterrupt(GBMEM &mem);
+            CPUTrace traceBuffer;
+
+            void traceInstruction(const GBMEM &mem, uint16_t address, uint8_t inst) {
+                if constexpr (Log::traceEnabled) {
+                    traceBuffer.push({address, AF(), bc, de, hl, sp, inst,
+                                      {mem.read8(address + 1), mem.read8(address + 2)}, 0});
+                }
+            }
+
+            void runTable(GBMEM &mem);
+            void runThreaded(GBMEM &mem);
+            void runBlocks(GBMEM &mem);
+            void runDynarec(GBMEM &mem);
+
+            BlockCache blockCache;
+            Block *compileBlock(GBMEM &mem, uint16_t address);
+            uint16_t runBlock(GBMEM &mem, const Block &block);
+
+            // Plain function entry points to the handlers, called from
+            // generated code.
+            using Thunk = uint16_t(*)(GBCPU*, GBMEM*, uint16_t);
+            template<Handler handler>
+            static uint16_t thunk(GBCPU *cpu, GBMEM *mem, uint16_t address) { return (cpu->*handler)(*mem, address); }
+            static Thunk thunkFor(uint8_t opcode, uint8_t cb);
+
+            Dynarec dynarec;
 
             enum R8 {
                 r8_B  = 0,
@@ -163,126 +389,216 @@ class GBCPU {
                 cond_C  = 3,
             };
 
-            std::array<uint8_t, 8> vec = {
-                0x00, 0x08, 0x10, 0x18, 0x20, 0x28, 0x30, 0x38
-            };
+            // Operand fields of an opcode, for handlers specialized at
+            // compile time.
+            static constexpr R8 r8Low(uint8_t opcode) { return static_cast<R8>(opcode & 0b111); }
+            static constexpr R8 r8High(uint8_t opcode) { return static_cast<R8>((opcode & 0b00111000) >> 3); }
+            static constexpr R16 r16(uint8_t opcode) { return static_cast<R16>((opcode & 0b00110000) >> 4); }
+            static constexpr R16STK r16stk(uint8_t opcode) { return static_cast<R16STK>((opcode & 0b00110000) >> 4); }
+            static constexpr R16MEM r16mem(uint8_t opcode) { return static_cast<R16MEM>((opcode & 0b00110000) >> 4); }
+            static constexpr COND cond(uint8_t opcode) { return static_cast<COND>((opcode & 0b00011000) >> 3); }
+            static constexpr uint8_t b3(uint8_t opcode) { return (opcode & 0b00111000) >> 3; }
+            static constexpr uint16_t tgt3(uint8_t opcode) { return opcode & 0b00111000; }
+
+            template<R16 reg>
+            uint16_t readR16() const {
+                if constexpr (reg == r16_BC) return bc;
+                else if constexpr (reg == r16_DE) return de;
+                else if constexpr (reg == r16_HL) return hl;
+                else return sp;
+            }
+
+            template<R16 reg>
+            void storeR16(uint16_t val) {
+                if constexpr (reg == r16_BC) bc = val;
+                else if constexpr (reg == r16_DE) de = val;
+                else if constexpr (reg == r16_HL) hl = val;
+                else sp = val;
+            }
+
+            template<R16STK reg>
+            uint16_t readR16STK() const {
+                if constexpr (reg == r16stk_BC) return bc;
+                else if constexpr (reg == r16stk_DE) return de;
+                else if constexpr (reg == r16stk_HL) return hl;
+                else return AF();
+            }
+
+            template<R16STK reg>
+            void storeR16STK(uint16_t val) {
+                if constexpr (reg == r16stk_BC) bc = val;
+                else if constexpr (reg == r16stk_DE) de = val;
+                else if constexpr (reg == r16stk_HL) hl = val;
+                else AF(val);
+            }
+
+            // Address for the [r16mem] operand; [HL+]/[HL-] adjust HL.
+            template<R16MEM reg>
+            uint16_t r16memAddress() {
+                if constexpr (reg == r16mem_BC) return bc;
+                else if constexpr (reg == r16mem_DE) return de;
+                else if constexpr (reg == r16mem_HLP) return hl++;
+                else return hl--;
+            }
+
+            template<COND c>
+            bool hasCond() const {
+                if constexpr (c == cond_NZ) return !hasZ();
+                else if constexpr (c == cond_Z) return hasZ();
+                else if constexpr (c == cond_NC) return !hasC();
+                else return hasC();
+            }
+
+            uint16_t pop16(const GBMEM &mem) { uint16_t val = mem.read16(sp); sp += 2; return val; }
+            void push16(GBMEM &mem, uint16_t val) { sp -= 2; mem.store16(sp, val); }
+
+            // Shared ALU cores of the r8 and imm8 forms.
+            void addA(uint8_t val, uint8_t carry);
+            void subA(uint8_t val, uint8_t carry);
+            void andA(uint8_t val);
+            void xorA(uint8_t val);
+            void orA(uint8_t val);
+            void cpA(uint8_t val);
+
+            // Compile-time register access for specialized handlers. r8_HL
+            // is the byte at [HL].
+            template<R8 reg>
+            uint8_t readR8(const GBMEM &mem) const {
+                if constexpr (reg == r8_A) return A();
+                else if constexpr (reg == r8_B) return B();
+                else if constexpr (reg == r8_C) return C();
+                else if constexpr (reg == r8_D) return D();
+                else if constexpr (reg == r8_E) return E();
+                else if constexpr (reg == r8_H) return H();
+                else if constexpr (reg == r8_L) return L();
+                else return mem.read8(hl);
+            }
 
-            uint16_t readR16(R16 reg);
-            void storeR16(R16 reg, uint16_t val);
-            uint8_t readR8(R8 reg);
-            void storeR8(R8 reg, uint8_t val);
-            bool hasCond(COND cond);
+            template<R8 reg>
+            void storeR8(GBMEM &mem, uint8_t val) {
+                if constexpr (reg == r8_A) A(val);
+                else if constexpr (reg == r8_B) B(val);
+                else if constexpr (reg == r8_C) C(val);
+                else if constexpr (reg == r8_D) D(val);
+                else if constexpr (reg == r8_E) E(val);
+                else if constexpr (reg == r8_H) H(val);
+                else if constexpr (reg == r8_L) L(val);
+                else mem.store8(hl, val);
+            }
 
             // INSTRUCTION HANDLERS
+            // Instantiated per opcode by makeDecodeTable.
           
             uint16_t handleInvalid(GBMEM& mem, uint16_t address);
             // ----------------------------
             //          BLOCK 0
             // ----------------------------
-            uint16_t handleNOP(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleNOP(GBMEM& mem, uint16_t address);
 
-            uint16_t handleLDR16IMM16(GBMEM& mem, uint16_t address);
-            uint16_t handleLDR16MEMA(GBMEM& mem, uint16_t address);
-            uint16_t handleLDAR16MEM(GBMEM& mem, uint16_t address);
-            uint16_t handleLDIMM16SP(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDR16IMM16(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDR16MEMA(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDAR16MEM(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDIMM16SP(GBMEM& mem, uint16_t address);
 
-            uint16_t handleINCR16(GBMEM& mem, uint16_t address);
-            uint16_t handleDECR16(GBMEM& mem, uint16_t address);
-            uint16_t handleADDHLR16(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleINCR16(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleDECR16(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleADDHLR16(GBMEM& mem, uint16_t address);
 
-            uint16_t handleINCR8(GBMEM& mem, uint16_t address);
-            uint16_t handleDECR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleINCR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleDECR8(GBMEM& mem, uint16_t address);
 
-            uint16_t handleLDR8IMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDR8IMM8(GBMEM& mem, uint16_t address);
 
-            uint16_t handleRLCA(GBMEM& mem, uint16_t address);
-            uint16_t handleRRCA(GBMEM& mem, uint16_t address);
-            uint16_t handleRLA(GBMEM& mem, uint16_t address);
-            uint16_t handleRRA(GBMEM& mem, uint16_t address);
-            uint16_t handleDAA(GBMEM& mem, uint16_t address);
-            uint16_t handleCPL(GBMEM& mem, uint16_t address);
-            uint16_t handleSCFA(GBMEM& mem, uint16_t address);
-            uint16_t handleCCF(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRLCA(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRRCA(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRLA(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRRA(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleDAA(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleCPL(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSCFA(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleCCF(GBMEM& mem, uint16_t address);
 
-            uint16_t handleJRIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleJRCONDIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleJRIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleJRCONDIMM8(GBMEM& mem, uint16_t address);
 
-            uint16_t handleSTOP(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSTOP(GBMEM& mem, uint16_t address);
 
             // ----------------------------
             //          BLOCK 1
             // ----------------------------
-            uint16_t handleLDR8R8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDR8R8(GBMEM& mem, uint16_t address);
 
-            uint16_t handleHALT(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleHALT(GBMEM& mem, uint16_t address);
 
             // ----------------------------
             //          BLOCK 2
             // ----------------------------
-            uint16_t handleADDAR8(GBMEM& mem, uint16_t address);
-            uint16_t handleADCAR8(GBMEM& mem, uint16_t address);
-            uint16_t handleSUBAR8(GBMEM& mem, uint16_t address);
-            uint16_t handleSBCAR8(GBMEM& mem, uint16_t address);
-            uint16_t handleANDAR8(GBMEM& mem, uint16_t address);
-            uint16_t handleXORAR8(GBMEM& mem, uint16_t address);
-            uint16_t handleORAR8(GBMEM& mem, uint16_t address);
-            uint16_t handleCPAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleADDAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleADCAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSUBAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSBCAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleANDAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleXORAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleORAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleCPAR8(GBMEM& mem, uint16_t address);
 
             // ----------------------------
             //          BLOCK 3
             // ----------------------------
-            uint16_t handleADDAIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleADCAIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleSUBAIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleSBCAIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleANDAIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleXORAIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleORAIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleCPAIMM8(GBMEM& mem, uint16_t address);
-
-            uint16_t handleRETCOND(GBMEM& mem, uint16_t address);
-            uint16_t handleRET(GBMEM& mem, uint16_t address);
-            uint16_t handleRETI(GBMEM& mem, uint16_t address);
-            uint16_t handleJPCONDIMM16(GBMEM& mem, uint16_t address);
-            uint16_t handleJPIMM16(GBMEM& mem, uint16_t address);
-            uint16_t handleJPHL(GBMEM& mem, uint16_t address);
-            uint16_t handleCALLCONDIMM16(GBMEM& mem, uint16_t address);
-            uint16_t handleCALLIMM16(GBMEM& mem, uint16_t address);
-            uint16_t handleRSTTGT3(GBMEM& mem, uint16_t address);
-
-            uint16_t handlePOPR16STK(GBMEM& mem, uint16_t address);
-            uint16_t handlePUSHR16STK(GBMEM& mem, uint16_t address);
-
-            uint16_t handleLDHCA(GBMEM& mem, uint16_t address);
-            uint16_t handleLDHIMM8A(GBMEM& mem, uint16_t address);
-            uint16_t handleLDIMM16A(GBMEM& mem, uint16_t address);
-            uint16_t handleLDHAC(GBMEM& mem, uint16_t address);
-            uint16_t handleLDHAIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleLDAIMM16(GBMEM& mem, uint16_t address);
-
-            uint16_t handleADDSPIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleLDHLSPIMM8(GBMEM& mem, uint16_t address);
-            uint16_t handleLDSPHL(GBMEM& mem, uint16_t address);
-
-            uint16_t handleDI(GBMEM& mem, uint16_t address);
-            uint16_t handleEI(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleADDAIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleADCAIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSUBAIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSBCAIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleANDAIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleXORAIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleORAIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleCPAIMM8(GBMEM& mem, uint16_t address);
+
+            template<uint8_t opcode> uint16_t handleRETCOND(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRET(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRETI(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleJPCONDIMM16(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleJPIMM16(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleJPHL(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleCALLCONDIMM16(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleCALLIMM16(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRSTTGT3(GBMEM& mem, uint16_t address);
+
+            template<uint8_t opcode> uint16_t handlePOPR16STK(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handlePUSHR16STK(GBMEM& mem, uint16_t address);
+
+            template<uint8_t opcode> uint16_t handleLDHCA(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDHIMM8A(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDIMM16A(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDHAC(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDHAIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDAIMM16(GBMEM& mem, uint16_t address);
+
+            template<uint8_t opcode> uint16_t handleADDSPIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDHLSPIMM8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleLDSPHL(GBMEM& mem, uint16_t address);
+
+            template<uint8_t opcode> uint16_t handleDI(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleEI(GBMEM& mem, uint16_t address);
 
             // ----------------------------
             //          BLOCK 4
             // ----------------------------
-            uint16_t handleCB(GBMEM& mem, uint16_t address);
-
-            uint16_t handleRLCR8(GBMEM& mem, uint16_t address);
-            uint16_t handleRRCR8(GBMEM& mem, uint16_t address);
-            uint16_t handleRLR8(GBMEM& mem, uint16_t address);
-            uint16_t handleRRR8(GBMEM& mem, uint16_t address);
-            uint16_t handleSLAR8(GBMEM& mem, uint16_t address);
-            uint16_t handleSRAR8(GBMEM& mem, uint16_t address);
-            uint16_t handleSWAPR8(GBMEM& mem, uint16_t address);
-            uint16_t handleSRLR8(GBMEM& mem, uint16_t address);
-
-            uint16_t handleBITB3R8(GBMEM& mem, uint16_t address);
-            uint16_t handleRESB3R8(GBMEM& mem, uint16_t address);
-            uint16_t handleSETB3R8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleCB(GBMEM& mem, uint16_t address);
+
+            // CB handlers are instantiated per second byte; the register
+            // and bit index are taken from the template argument.
+            template<uint8_t opcode> uint16_t handleRLCR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRRCR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRLR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRRR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSLAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSRAR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSWAPR8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSRLR8(GBMEM& mem, uint16_t address);
+
+            template<uint8_t opcode> uint16_t handleBITB3R8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleRESB3R8(GBMEM& mem, uint16_t address);
+            template<uint8_t opcode> uint16_t handleSETB3R8(GBMEM& mem, uint16_t address);
 };
 
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <ppu/GBPpu.h>
+#include <cstddef>
+#include <cstdint>
+
+// The LCD on the host. A frame of shades is written once, straight into a
+// pixel buffer object, and goes from there into a one byte per pixel
+// texture with a single glTexSubImage2D; the fragment shader turns shades
+// into colors. Where GL 4.4 buffer storage exists the buffer is mapped
+// once for good and used as a ring of three frames fenced against the
+// GPU; elsewhere it is orphaned and mapped again every frame.
+//
+// Needs a current GL 3.0+ context from init() to shutdown().
+class Screen {
+    public:
+        bool init(const char *glslVersion);
+        void shutdown();
+
+        void upload(const GBPPU::Frame &frame);
+        // Draws the last upload at the largest integer scale that fits,
+        // centered in a viewport of width x height pixels.
+        void draw(int width, int height);
+
+        // Upload cost as running averages: CPU time to write the buffer
+        // and issue the copy, and GPU time of the copy once the timer
+        // query comes back (0 without GL 3.3 timer queries).
+        double uploadMicros() const { return uploadCpu; }
+        double uploadGpuMicros() const { return uploadGpu; }
+        double drawMicros() const { return drawCpu; }
+        int scale() const { return lastScale; }
+        bool persistent() const { return mapped != nullptr; }
+
+    private:
+        static constexpr size_t FRAME_BYTES = sizeof(GBPPU::Frame);
+        static constexpr unsigned RING = 3;
+        static constexpr unsigned QUERIES = 4;
+
+        void collectQueries();
+
+        unsigned texture = 0, buffer = 0, program = 0, vertexArray = 0;
+        int rectUniform = -1;
+
+        // Persistent mapping and the fence guarding each ring slot.
+        uint8_t *mapped = nullptr;
+        void *fences[RING] = {};
+        unsigned slot = 0;
+
+        // GPU timer queries in flight, oldest read first.
+        unsigned queries[QUERIES] = {};
+        unsigned queryHead = 0, queryPending = 0;
+        bool timed = false;
+
+        double uploadCpu = 0, uploadGpu = 0, drawCpu = 0;
+        int lastScale = 0;
+};
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <memory/RomImage.h>
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Cartridge RAM: owned memory, or a shared mapping of the save file so
+// stores land in the page cache and outlive a crash of the process. Copies
+// are always plain owned memory and never write the file.
+class CartRAM {
+    public:
+        CartRAM() = default;
+        CartRAM(const CartRAM &other) { *this = other; }
+        CartRAM &operator=(const CartRAM &other);
+        ~CartRAM();
+
+        // Drops any save file and allocates size zeroed bytes.
+        void reset(size_t size);
+        // Backs the RAM by path. An existing file's contents win; a new
+        // or short file is filled from the current contents.
+        bool persist(const char *path);
+        bool persisted() const { return !path.empty(); }
+
+        uint8_t *data() { return bytes; }
+        const uint8_t *data() const { return bytes; }
+        size_t size() const { return length; }
+
+        // Extends the range flush() has to write back.
+        void written(size_t offset, size_t count) {
+            dirtyBegin = dirty() ? std::min(dirtyBegin, offset) : offset;
+            dirtyEnd = std::max(dirtyEnd, offset + count);
+        }
+        bool dirty() const { return dirtyEnd > dirtyBegin; }
+        // Starts writing the dirty range back, or with wait, finishes it.
+        void flush(bool wait);
+
+    private:
+        void release();
+
+        std::vector<uint8_t> owned;
+        uint8_t *bytes = nullptr;
+        size_t length = 0;
+        void *mapping = nullptr;
+        std::string path;
+        size_t dirtyBegin = 0;
+        size_t dirtyEnd = 0;
+};
+
+// A game cartridge: a shared ROM image, its header, the MBC banking
+// registers and the external RAM. Bank switching only moves the window
+// pointers, so nothing is copied however large the ROM is. Copies share
+// the image; the registers and RAM are their own.
+class Cartridge {
+    public:
+        enum class MBC : uint8_t { None, MBC1, MBC3, MBC5 };
+
+        static constexpr size_t ROM_BANK_SIZE = RomImage::BANK_SIZE;
+        static constexpr size_t RAM_BANK_SIZE = 0x2000;
+
+        // Parses the header and powers the cartridge up with the image.
+        bool insert(RomImage::Handle image);
+        bool loaded() const { return rom != nullptr; }
+        const RomImage::Handle &romImage() const { return image; }
+
+        const char *title() const { return header.title; }
+        MBC mbc() const { return type; }
+        uint8_t typeCode() const { return header.type; }
+        size_t romSize() const { return romBanks * ROM_BANK_SIZE; }
+        size_t ramSize() const { return ram.size(); }
+        bool headerChecksumOK() const { return header.checksumOK; }
+        bool battery() const { return header.battery; }
+
+        // Persists battery backed RAM to a save file. Fails for cartridges
+        // without both.
+        bool attachSave(const char *path);
+        bool hasSave() const { return ram.persisted(); }
+        // A store through the direct RAM window, so the 256 byte page it
+        // hit has to reach the file.
+        void ramWritten(uint16_t address) {
+            ram.written(size_t(ramBankNumber) * RAM_BANK_SIZE + (address & 0x1F00), 0x100);
+        }
+        bool saveDirty() const { return ram.dirty(); }
+        void flushSave(bool wait) { ram.flush(wait); }
+
+        // slot 0 is 0000-3FFF, slot 1 is 4000-7FFF.
+        const uint8_t *romWindow(unsigned slot) const { return rom + size_t(romBank[slot]) * ROM_BANK_SIZE; }
+        uint16_t romBankAt(unsigned slot) const { return romBank[slot]; }
+        // Directly mapped RAM at A000-BFFF, or null when it has to go
+        // through readRAM/writeRAM (disabled, absent or an RTC register).
+        uint8_t *ramWindow() {
+            return ramMapped ? ram.data() + size_t(ramBankNumber) * RAM_BANK_SIZE : nullptr;
+        }
+        uint16_t ramBank() const { return ramBankNumber; }
+        const uint8_t *ramData() const { return ram.data(); }
+
+        // The banking registers, plus enough of the header to refuse a state
+        // saved with another game.
+        struct State {
+            uint32_t romBanks;
+            uint16_t globalChecksum;
+            uint8_t type, headerChecksum;
+            uint8_t ramEnabled, bankLow, bankHigh, ramSelect, mbc1Mode;
+            std::array<uint8_t, 5> rtc;
+            uint8_t reserved[2];
+        };
+        void saveState(State &state) const;
+        bool matches(const State &state) const;
+        void loadState(const State &state);
+        // The RAM is saved separately since its size depends on the game.
+        void loadRAM(const uint8_t *data);
+        void restoreRAM(size_t offset, const uint8_t *data, size_t size) {
+            std::memcpy(ram.data() + offset, data, size);
+            ram.written(offset, size);
+        }
+
+        // A write to 0000-7FFF. Returns true if a window moved.
+        bool writeRegister(uint16_t address, uint8_t data);
+        uint8_t readRAM(uint16_t address) const;
+        void writeRAM(uint16_t address, uint8_t data);
+
+    private:
+        struct Header {
+            char title[17] = {};
+            uint8_t type = 0;
+            bool battery = false;
+            bool checksumOK = false;
+        };
+
+        void updateBanks();
+
+        RomImage::Handle image;
+        const uint8_t *rom = nullptr;
+        uint32_t romBanks = 0;
+        Header header;
+        MBC type = MBC::None;
+        CartRAM ram;
+
+        // MBC registers, interpreted per type by updateBanks().
+        bool ramEnabled = false;
+        uint8_t bankLow = 1;
+        uint8_t bankHigh = 0;
+        uint8_t ramSelect = 0;
+        bool mbc1Mode = false;
+        // MBC3 clock registers are kept but do not tick.
+        std::array<uint8_t, 5> rtc{};
+
+        std::array<uint16_t, 2> romBank{0, 1};
+        uint16_t ramBankNumber = 0;
+        bool ramMapped = false;
+};
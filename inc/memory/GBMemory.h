@@ -1,14 +1,360 @@
 #pragma once
 
+#include <memory/Cartridge.h>
+#include <memory/Scheduler.h>
 #include <array>
+#include <bit>
+#include <bitset>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <vector>
 
+// The fast paths must inline even into the 256-way threaded interpreter,
+// where GCC otherwise gives up on them.
+#if defined(__GNUC__)
+#define GB_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define GB_ALWAYS_INLINE inline
+#endif
+
+// The CPU bus. Every 256 byte page has a direct pointer for reads and one
+// for writes when it is plain memory; a null pointer sends the access to
+// the page's region handler instead (MBC registers, disabled cart RAM, I/O).
+// ROM pages point straight into the cartridge's current banks. Page 0xFF
+// holds the I/O registers, HRAM and IE and is always handled here, with
+// optional per register handlers for FF00-FF7F.
+//
+// Footprint per instance, all inline:
+//     VRAM and WRAM                8 KB + 8 KB
+//     OAM, I/O registers, HRAM     0.5 KB
+//     read/write/backing pages     6 KB    3 x 256 pointers
+//     region handlers              9 KB    256 page + 128 I/O, 24 bytes each
+//     Cartridge, code page marks,  under 1 KB
+//     scheduler and the rest
+// which comes to a little over 32 KB. Cartridge RAM is allocated per
+// instance on top of that; the ROM is not, it is shared between instances
+// through a shared_ptr<const RomImage>.
 class GBMEM {
     public:
-        uint8_t read8(uint16_t address) const { _MEM[address]; }
-        void store8(uint16_t address, int8_t data) { _MEM[address] = data; }
-        uint8_t read16(uint16_t address) const { _MEM[address + 1] << 8 + _MEM[address]; }
-        void store16(uint16_t address, int8_t data) { _MEM[address + 1] = data >> 8; _MEM[address] = data & 0xFF; }
+        using ReadHandler = uint8_t(*)(void *context, uint16_t address);
+        using WriteHandler = void(*)(void *context, uint16_t address, uint8_t data);
+
+        GBMEM();
+        GBMEM(const GBMEM &other);
+        GBMEM &operator=(const GBMEM &other);
+
+        GB_ALWAYS_INLINE uint8_t read8(uint16_t address) const {
+            if (const uint8_t *page = readPages[address >> 8]) return page[address & 0xFF];
+            return readSlow(address);
+        }
+        GB_ALWAYS_INLINE void store8(uint16_t address, uint8_t data) {
+            if (uint8_t *page = writePages[address >> 8]) page[address & 0xFF] = data;
+            else storeSlow(address, data);
+        }
+        GB_ALWAYS_INLINE uint16_t read16(uint16_t address) const {
+            const uint8_t *page = readPages[address >> 8];
+            if (std::endian::native == std::endian::little && page && (address & 0xFF) != 0xFF) {
+                uint16_t val;
+                std::memcpy(&val, page + (address & 0xFF), sizeof(val));
+                return val;
+            }
+            return (read8(address + 1) << 8) | read8(address);
+        }
+        void store16(uint16_t address, uint16_t data) { store8(address, data & 0xFF); store8(address + 1, data >> 8); }
+
+        // Inserts a shared ROM image into the cartridge slot; any number of
+        // buses can map the same one.
+        bool insert(RomImage::Handle image);
+        // Opens a ROM file (or copies an image) just for this bus.
+        bool loadROM(const char *path);
+        bool loadROM(const uint8_t *data, size_t size);
+        const Cartridge &cartridge() const { return cart; }
+
+        // Backs battery RAM by a save file. The first store into each RAM
+        // page after a flush takes the slow path to mark it dirty; after
+        // that the page is plain memory again until the next flush.
+        bool attachSave(const char *path);
+        // Writes dirty save pages back; without wait this only starts it.
+        // Call it periodically to bound what a system crash can lose.
+        void flushSave(bool wait);
+
+        // What the clock-driven hardware keeps beyond its registers: the
+        // divider's offset from the clock, the cycle TIMA was last brought
+        // up to, and the cycle each event is due on (NEVER if none).
+        static constexpr size_t EVENT_KINDS = 4;
+        struct TimingState {
+            uint64_t divider;
+            uint64_t timerSynced;
+            std::array<uint64_t, EVENT_KINDS> events;
+        };
+
+        // Everything on the bus that is not the ROM, for save states. Cart
+        // RAM is written to ram, cartridge().ramSize() bytes. Loading
+        // drops the marks on code pages so cached code is rebuilt, and
+        // refuses a state from another game.
+        struct State {
+            std::array<uint8_t, 0x2000> vram, wram;
+            std::array<uint8_t, 0x100> oam;
+            std::array<uint8_t, 0x80> io, hram;
+            Cartridge::State cart;
+            TimingState timing;
+        };
+        void saveState(State &state, uint8_t *ram) const;
+        bool loadState(const State &state, const uint8_t *ram);
+
+        // DELTA TRACKING
+        // The memory in a state, as numbered 256 byte pages: VRAM, WRAM,
+        // OAM, then the cartridge RAM. I/O and HRAM are small enough to
+        // always be saved whole.
+        static constexpr size_t STATE_PAGE_SIZE = 0x100;
+        static constexpr size_t MAX_STATE_PAGES = 0x41 + 0x20000 / STATE_PAGE_SIZE;
+        size_t statePages() const { return 0x41 + cart.ramSize() / STATE_PAGE_SIZE; }
+        const uint8_t *statePage(size_t index) const;
+
+        // Starts recording which pages are written from now on, against a
+        // base state identified by base. The first store into each page
+        // takes the slow path once to mark it. Loading a full state marks
+        // everything written.
+        void trackWrites(uint64_t base);
+        uint64_t trackedBase() const { return deltaBase; }
+        size_t writtenPages() const { return pagesWritten.count(); }
+
+        // The rest of a delta: the small blocks whole, then the index and
+        // contents of each written page, ascending.
+        struct DeltaState {
+            std::array<uint8_t, 0x80> io, hram;
+            Cartridge::State cart;
+            TimingState timing;
+        };
+        void saveDelta(DeltaState &state, uint16_t *indices, uint8_t *pages) const;
+        // Applies a delta over its base, which must have just been loaded,
+        // and resumes tracking against that base.
+        bool loadDelta(const DeltaState &state, const uint16_t *indices, const uint8_t *pages, size_t count);
+
+        // Routes pages first..last through handlers. A null handler leaves
+        // that direction as it was. Contexts are shared by copies.
+        void mapRegion(uint8_t first, uint8_t last, ReadHandler read, WriteHandler write, void *context);
+        // Same for a single register in FF00-FF7F. Unhandled registers
+        // read back what was last written.
+        void mapIO(uint16_t address, ReadHandler read, WriteHandler write, void *context);
+
+        // Buttons held on the host, a bit each, set while pressed. They are
+        // input rather than machine state, so states leave them alone. P1
+        // (FF00) reads them through the select bits last written, and a
+        // press on a selected line requests the joypad interrupt.
+        enum Button : uint8_t {
+            RIGHT = 0x01, LEFT = 0x02, UP = 0x04, DOWN = 0x08,
+            A = 0x10, B = 0x20, SELECT = 0x40, START = 0x80,
+        };
+        void setButtons(uint8_t pressed);
+        uint8_t heldButtons() const { return buttons; }
+
+        // LCD TIMING
+        // The LCD runs off the CPU clock, 154 lines of 114 M-cycles a frame
+        // counted from power on, so LY and the STAT mode are worked out from
+        // the clock when read and need no state of their own. The LCD is
+        // never out of step with the clock, even across LCDC.7. The CPU
+        // running on the bus points it at its cycle counter.
+        static constexpr uint64_t CYCLES_PER_LINE = 114;
+        static constexpr uint64_t OAM_SCAN_CYCLES = 20;
+        static constexpr uint64_t TRANSFER_CYCLES = 43;
+        static constexpr unsigned LINES_PER_FRAME = 154;
+        static constexpr unsigned VISIBLE_LINES = 144;
+        void setClock(const uint64_t *cycles) { clock = cycles; }
+        uint64_t now() const { return clock ? *clock : 0; }
+
+        // INTERRUPTS AND EVENTS
+        // Nothing on the bus ticks. What the clock drives (TIMA overflow,
+        // the VBlank and STAT interrupts, the end of a serial transfer or
+        // an OAM DMA) is an event due on a known cycle, kept in a min-heap
+        // and worked out from the registers whenever one of them is
+        // written. The CPU runs undisturbed up to nextEvent(), then has
+        // runEvents() catch up; between instructions it only looks at
+        // pendingInterrupts().
+        enum Interrupt : uint8_t {
+            VBLANK = 0x01, LCD_STAT = 0x02, TIMER = 0x04, SERIAL = 0x08, JOYPAD = 0x10,
+        };
+        static constexpr uint64_t NEVER = Scheduler<EVENT_KINDS>::NEVER;
+        uint64_t nextEvent() const { return events.next(); }
+        // The CPU points this at the cycle it is running up to, and a store
+        // that schedules an event before that, or makes an interrupt
+        // pending, pulls it in.
+        void setDeadline(uint64_t *until) { deadline = until; }
+        // Runs every event due by now(), in order. Returns how many ran.
+        unsigned runEvents();
+        uint64_t eventCount() const { return eventsRun; }
+        // Requested (IF) and enabled (IE), a bit per Interrupt.
+        uint8_t pendingInterrupts() const { return pending; }
+        void requestInterrupt(uint8_t interrupts) {
+            io[0x0F] |= interrupts;
+            pending = io[0x0F] & hram[0x7F] & 0x1F;
+        }
+        // Clears the request as the CPU takes it.
+        void acknowledgeInterrupt(uint8_t interrupt) {
+            io[0x0F] &= ~interrupt;
+            pending = io[0x0F] & hram[0x7F] & 0x1F;
+        }
+        // The cycle until which reading address keeps giving what it gives
+        // now, while nothing is stored and no event runs: the next LY or
+        // STAT mode change, DIV or TIMA step; NEVER for what only stores
+        // and events change; now() where that is not known.
+        uint64_t steadyUntil(uint16_t address) const;
+
+        // SOUND
+        // FF10-FF3F act as registers here: unused bits read as 1, clearing
+        // NR52.7 powers sound off and clears the rest, and NR52's channel
+        // bits follow triggers and the DACs. They do not see a length run
+        // out; only the APU times the channels. While recording, every store
+        // that took effect is logged with the clock for an APU to replay.
+        // Like the changed sprites, only one APU can follow a bus; copies
+        // and loaded states start with an empty log.
+        struct SoundWrite {
+            uint64_t cycle;
+            uint16_t address;
+            uint8_t data;
+        };
+        void recordSound(bool on) {
+            recordingSound = on;
+            soundWrites.clear();
+        }
+        // Hands over the log, leaving writes' storage for the next one.
+        void takeSoundWrites(std::vector<SoundWrite> &writes) {
+            writes.clear();
+            writes.swap(soundWrites);
+        }
+
+        // What the PPU draws from.
+        const std::array<uint8_t, 0x2000> &videoRAM() const { return vram; }
+        const std::array<uint8_t, 0x100> &objectRAM() const { return oam; }
+        // The last value written to an I/O register in FF00-FF7F.
+        uint8_t ioRegister(uint16_t address) const { return io[address & 0x7F]; }
+
+        // Bank currently mapped at address, so cached code can be keyed by
+        // what is actually there.
+        uint16_t bankOf(uint16_t address) const { return banks[address >> 13]; }
+        // Bumped whenever 0000-3FFF changes bank (MBC1 mode 1), for code that
+        // assumed it fixed.
+        uint32_t fixedBankGeneration() const { return bank0Generation; }
+
+        // Pages holding predecoded code. Marked RAM pages leave the write
+        // fast path; a store into one clears the mark and records it as
+        // stale until the cache collects it. ROM is never written, so it
+        // is not tracked, but switching a ROM bank counts as a code write
+        // so a block running from the old bank ends there.
+        void markCode(uint8_t page);
+        uint32_t codeWriteCount() const { return codeWrites; }
+        // Generated code polls the counter in place.
+        const uint32_t *codeWriteCounter() const { return &codeWrites; }
+        std::bitset<256> takeStaleCode() {
+            std::bitset<256> stale = staleCode;
+            staleCode.reset();
+            return stale;
+        }
+
+        // OAM entries changed since the last call, a bit per 4 byte entry:
+        // stored into, filled by DMA or replaced by loading a state. OAM
+        // stores always take the slow path to be seen; games mostly use DMA.
+        // Taking clears them, so only one PPU can follow a bus.
+        static constexpr unsigned SPRITES = 40;
+        uint64_t takeChangedSprites() {
+            uint64_t changed = changedSprites;
+            changedSprites = 0;
+            return changed;
+        }
     private:
-        std::array<uint8_t, 0x10000> _MEM;
+        struct Region {
+            ReadHandler read = nullptr;
+            WriteHandler write = nullptr;
+            void *context = nullptr;
+        };
+
+        uint8_t readSlow(uint16_t address) const;
+        void storeSlow(uint16_t address, uint8_t data);
+        uint8_t readHigh(uint16_t address) const;
+        void storeHigh(uint16_t address, uint8_t data);
+        uint16_t lcdStatus() const;
+        void storeSound(uint16_t address, uint8_t data);
+
+        enum Event : uint8_t { LCD_EVENT, TIMER_EVENT, SERIAL_EVENT, DMA_EVENT };
+        void schedule(Event event, uint64_t time);
+        void interruptBitsStored();
+        void runEvent(unsigned event, uint64_t time);
+        bool statLine(uint64_t time) const;
+        void scheduleLCD(uint64_t after);
+        void storeLCD(uint16_t address, uint8_t data);
+        uint64_t timerCounter(uint64_t time) const { return 4 * time + divider; }
+        unsigned timerEdges(uint64_t from, uint64_t to) const;
+        uint8_t timaAt(uint64_t time, unsigned *overflows = nullptr) const;
+        void syncTimer(uint64_t time);
+        void scheduleTimer();
+        void storeTimer(uint16_t address, uint8_t data);
+        void saveTiming(TimingState &state) const;
+        void loadTiming(const TimingState &state);
+        uint8_t joypadLines() const;
+        void codeWritten(uint8_t page);
+        void dma(uint8_t source);
+        void saveWritten(uint8_t page, uint16_t address);
+        void deltaWritten(uint8_t page);
+        int statePageOf(unsigned page) const;
+        // Traps stores into pages not yet marked as written since the base.
+        void armDelta(unsigned first, unsigned last);
+        bool trapsWrites(unsigned page) const {
+            return page == 0xFE || codePages[page] || deltaClean[page] || (isCartRAM(page) && saveClean[page - 0xA0]);
+        }
+        static bool isCartRAM(unsigned page) { return page >= 0xA0 && page < 0xC0; }
+        // Rebuilds page pointers from the storage and region state.
+        void remap(unsigned first = 0x00, unsigned last = 0xFF);
+        void remapCartridge();
+
+        // Echo RAM (E000-FDFF) and WRAM are the same memory on two pages.
+        static int echoOf(uint8_t page) {
+            if (page >= 0xC0 && page <= 0xDD) return page + 0x20;
+            if (page >= 0xE0 && page <= 0xFD) return page - 0x20;
+            return -1;
+        }
+
+        Cartridge cart;
+        std::array<uint16_t, 8> banks{};
+        uint32_t bank0Generation = 0;
+
+        std::array<uint8_t, 0x2000> vram{};
+        std::array<uint8_t, 0x2000> wram{};
+        std::array<uint8_t, 0x100> oam{};     // FEA0-FEFF is unusable but backed
+        std::array<uint8_t, 0x80> io{};
+        std::array<uint8_t, 0x80> hram{};     // FF80-FFFE, then IE
+        uint8_t buttons = 0;
+        const uint64_t *clock = nullptr;
+        uint64_t *deadline = nullptr;
+        uint8_t pending = 0;
+        Scheduler<EVENT_KINDS> events;
+        uint64_t eventsRun = 0;
+        // The divider is the low 16 bits of timerCounter(), T-states since
+        // it was last reset.
+        uint64_t divider = 0;
+        uint64_t timerSynced = 0;
+        bool recordingSound = false;
+        std::vector<SoundWrite> soundWrites;
+
+        std::array<const uint8_t*, 256> readPages{};
+        std::array<uint8_t*, 256> writePages{};
+        // Writable backing of each page, whether or not it is marked.
+        std::array<uint8_t*, 256> memPages{};
+        std::array<Region, 256> regions{};
+        std::array<Region, 0x80> ioRegions{};
+
+        std::array<uint8_t, 256> codePages{};
+        std::bitset<256> staleCode;
+        uint32_t codeWrites = 0;
+        static constexpr uint64_t ALL_SPRITES = (uint64_t(1) << SPRITES) - 1;
+        uint64_t changedSprites = ALL_SPRITES;
+        // Cart RAM pages whose stores have not been recorded since the
+        // last flush, while a save file is attached.
+        std::bitset<0x20> saveClean;
+
+        // Nonzero while tracking writes for delta states.
+        uint64_t deltaBase = 0;
+        std::bitset<MAX_STATE_PAGES> pagesWritten;
+        // Bus pages whose next store has to be recorded.
+        std::bitset<256> deltaClean;
 };
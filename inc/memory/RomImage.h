@@ -0,0 +1,44 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+// An immutable cartridge ROM. Every bus that inserts the same handle maps
+// the same bytes, so running many instances of one game costs one copy of
+// the ROM however many there are. The image is freed with its last handle.
+class RomImage {
+    public:
+        using Handle = std::shared_ptr<const RomImage>;
+
+        static constexpr size_t BANK_SIZE = 0x4000;
+
+        // Maps a ROM file read only. Null on failure.
+        static Handle open(const char *path);
+        // Copies an in-memory image, for built-in programs.
+        static Handle copy(const uint8_t *data, size_t size, const char *name = "(memory)");
+
+        RomImage(const RomImage&) = delete;
+        RomImage &operator=(const RomImage&) = delete;
+        ~RomImage();
+
+        // Always a whole number of banks, at least two.
+        const uint8_t *data() const { return bytes; }
+        size_t size() const { return length; }
+        size_t banks() const { return length / BANK_SIZE; }
+        const char *name() const { return path.c_str(); }
+        // False when the file had to be copied (not whole banks, or no mmap).
+        bool mapped() const { return mapping != nullptr; }
+
+    private:
+        RomImage() = default;
+        void fill(const uint8_t *from, size_t size);
+
+        const uint8_t *bytes = nullptr;
+        size_t length = 0;
+        std::string path;
+        std::vector<uint8_t> owned;
+        void *mapping = nullptr;
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+// Events of a fixed set of kinds, at most one pending of each, in a binary
+// min-heap on the cycle each is due. Each kind remembers where it sits in
+// the heap, so scheduling one that is already pending moves it rather than
+// adding a second. Plain data: copying a scheduler copies its events.
+template<size_t KINDS>
+class Scheduler {
+    public:
+        static constexpr uint64_t NEVER = UINT64_MAX;
+
+        Scheduler() { position.fill(NONE); }
+
+        // When the earliest event is due, NEVER if none is pending.
+        uint64_t next() const { return count ? heap[0].time : NEVER; }
+        uint64_t dueAt(unsigned kind) const { return position[kind] == NONE ? NEVER : heap[position[kind]].time; }
+
+        void schedule(unsigned kind, uint64_t time) {
+            if (time == NEVER) {
+                cancel(kind);
+                return;
+            }
+            size_t at = position[kind];
+            if (at == NONE) at = count++;
+            place(at, {time, uint8_t(kind)});
+            siftUp(at);
+            siftDown(position[kind]);
+        }
+        void cancel(unsigned kind) {
+            size_t at = position[kind];
+            if (at == NONE) return;
+            position[kind] = NONE;
+            if (at == --count) return;
+            Entry moved = heap[count];
+            place(at, moved);
+            siftUp(at);
+            siftDown(position[moved.kind]);
+        }
+        // Takes the earliest event if it is due by now, giving its kind and
+        // the cycle it was due on.
+        bool pop(uint64_t now, unsigned &kind, uint64_t &time) {
+            if (!count || heap[0].time > now) return false;
+            kind = heap[0].kind;
+            time = heap[0].time;
+            cancel(kind);
+            return true;
+        }
+        void clear() {
+            position.fill(NONE);
+            count = 0;
+        }
+
+    private:
+        static constexpr uint8_t NONE = 0xFF;
+        static_assert(KINDS < NONE);
+
+        struct Entry {
+            uint64_t time;
+            uint8_t kind;
+        };
+
+        void place(size_t at, Entry entry) {
+            heap[at] = entry;
+            position[entry.kind] = uint8_t(at);
+        }
+        void siftUp(size_t at) {
+            Entry entry = heap[at];
+            while (at && heap[(at - 1) / 2].time > entry.time) {
+                place(at, heap[(at - 1) / 2]);
+                at = (at - 1) / 2;
+            }
+            place(at, entry);
+        }
+        void siftDown(size_t at) {
+            Entry entry = heap[at];
+            for (size_t child; (child = 2 * at + 1) < count; at = child) {
+                if (child + 1 < count && heap[child + 1].time < heap[child].time) ++child;
+                if (heap[child].time >= entry.time) break;
+                place(at, heap[child]);
+            }
+            place(at, entry);
+        }
+
+        std::array<Entry, KINDS> heap{};
+        std::array<uint8_t, KINDS> position{};
+        size_t count = 0;
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <cpu/GBCpu.h>
+#include <memory/GBMemory.h>
+#include <ppu/TileDecoder.h>
+#include <array>
+#include <bitset>
+#include <cstdint>
+
+// DMG picture processing, a scanline at a time. Each visible line is drawn
+// whole when the clock reaches its pixel transfer (mode 3), from the
+// registers and memory as they are then, so raster effects that change
+// registers between lines work; changes within a line's transfer do not.
+// Timing belongs to the bus (see GBMEM's LCD timing), so the PPU holds no
+// machine state and save states need nothing from it.
+//
+// Which sprites each line shows is kept from frame to frame and only
+// revisited for the OAM entries the bus reports changed, and of those
+// only the ones that moved: tile and attributes are read when drawing.
+// A line's list is rebuilt when it is next drawn after a sprite moved
+// onto, off or along it.
+class GBPPU {
+    public:
+        static constexpr unsigned WIDTH = 160;
+        static constexpr unsigned HEIGHT = GBMEM::VISIBLE_LINES;
+        // One shade (0 white to 3 black) per pixel, row by row.
+        using Frame = std::array<uint8_t, WIDTH * HEIGHT>;
+
+        explicit GBPPU(TileDecoder::Kernel kernel = TileDecoder::best()) : decoder(kernel) {}
+
+        // Runs cpu for at least cycles M-cycles, stopping at every line's
+        // transfer to draw it. Without draw nothing is drawn, for frames
+        // that are never shown. Returns the M-cycles run.
+        uint64_t run(GBCPU &cpu, GBMEM &mem, uint64_t cycles,
+                     GBCPU::Dispatch dispatch = GBCPU::defaultDispatch, bool draw = true);
+        // Runs to the end of the current frame, so a frame is whole however
+        // far the last run went past its own end.
+        uint64_t runFrame(GBCPU &cpu, GBMEM &mem, GBCPU::Dispatch dispatch = GBCPU::defaultDispatch,
+                          bool draw = true) {
+            uint64_t left = GBCPU::CYCLES_PER_FRAME - cpu.cycleCount() % GBCPU::CYCLES_PER_FRAME;
+            return run(cpu, mem, left, dispatch, draw);
+        }
+        // Draws one visible line from the current bus contents.
+        void drawLine(GBMEM &mem, unsigned line);
+
+        // The frame being drawn; complete whenever framesDrawn() changes.
+        const Frame &frame() const { return pixels; }
+        uint64_t framesDrawn() const { return completed; }
+        const TileDecoder &tiles() const { return decoder; }
+
+    private:
+        // Tiles gathered for a background or window row: the 21 a line can
+        // touch, rounded up so decoding has no scalar tail.
+        static constexpr unsigned ROW_TILES = 24;
+        static constexpr unsigned MAX_SPRITES_PER_LINE = 10;
+
+        // The sprites on a line, at most ten, in the order they win over
+        // each other.
+        struct LineSprites {
+            uint8_t count = 0;
+            uint8_t sprites[MAX_SPRITES_PER_LINE];
+        };
+
+        void syncSprites(GBMEM &mem);
+        void coverLines(unsigned sprite, bool covered);
+        const LineSprites &spritesOn(unsigned line);
+        void drawSprites(const GBMEM &mem, unsigned line, const uint8_t *background, uint8_t *out);
+
+        TileDecoder decoder;
+        Frame pixels{};
+        uint64_t completed = 0;
+        // Window rows drawn so far this frame; the window only advances on
+        // lines that show it.
+        unsigned windowLine = 0;
+
+        // Every sprite covering each line, a bit per OAM entry, as of the
+        // Y, X and sprite height the lists were built with. Height 0 means
+        // nothing is built yet.
+        std::array<uint64_t, HEIGHT> covering{};
+        std::array<LineSprites, HEIGHT> lines{};
+        std::bitset<HEIGHT> staleLines;
+        std::array<uint8_t, GBMEM::SPRITES> spriteY{}, spriteX{};
+        unsigned spriteHeight = 0;
+};
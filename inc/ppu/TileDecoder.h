@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define GB_TILE_SIMD_X86 1
+#else
+#define GB_TILE_SIMD_X86 0
+#endif
+
+// The PPU's inner loop. A row of a 2bpp tile is two bitplane bytes, lo and
+// hi; pixel i (leftmost first) has the color index (lo bit 7-i) | (hi bit
+// 7-i) << 1. A palette register then maps each index to a shade, 2 bits
+// per index, 0 white to 3 black.
+//
+// Kernels for SSSE3 and AVX2 are built with target attributes and picked
+// at run time, so the build needs no -m flags and runs anywhere. Every
+// kernel gives exactly what the scalar one does; mismatches() checks it.
+class TileDecoder {
+    public:
+        enum class Kernel { Scalar, SSSE3, AVX2 };
+
+        // The fastest kernel this CPU runs.
+        static Kernel best();
+        static bool supported(Kernel kernel);
+        static const char *name(Kernel kernel);
+
+        explicit TileDecoder(Kernel kernel = best());
+        Kernel kernel() const { return active; }
+
+        // Decodes tiles rows into 8 * tiles color indices. Counts that are
+        // a multiple of 8 run without a scalar tail.
+        void decode(const uint8_t *lo, const uint8_t *hi, size_t tiles, uint8_t *out) const {
+            decodeRow(lo, hi, tiles, out);
+        }
+        // Maps count color indices (0-3) through palette. Multiples of 32
+        // run without a scalar tail. out may be indices.
+        void shade(const uint8_t *indices, size_t count, uint8_t palette, uint8_t *out) const {
+            shadeRow(indices, count, palette, out);
+        }
+
+        // Runs kernel against the scalar one over every bitplane pair and
+        // every palette, at lengths that cover the vector loops and their
+        // tails, and returns how many outputs differ.
+        static size_t mismatches(Kernel kernel);
+
+    private:
+        using DecodeFn = void(*)(const uint8_t *lo, const uint8_t *hi, size_t tiles, uint8_t *out);
+        using ShadeFn = void(*)(const uint8_t *indices, size_t count, uint8_t palette, uint8_t *out);
+
+        Kernel active;
+        DecodeFn decodeRow;
+        ShadeFn shadeRow;
+};
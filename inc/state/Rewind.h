@@ -0,0 +1,60 @@
+#pragma once
+
+#include <cpu/GBCpu.h>
+#include <memory/GBMemory.h>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+// Rewind history: the last frames of gameplay as compressed frame to frame
+// deltas in a fixed size ring. Each capture saves the machine, XORs it with
+// the previous capture and run length codes the zeros, which is nearly all
+// of it. XOR is its own inverse, so stepping back applies the newest delta
+// to the last state and loads the result. When the ring or the frame limit
+// is full the oldest frames are dropped.
+class Rewind {
+    public:
+        explicit Rewind(size_t bufferBytes = 32 << 20, size_t maxFrames = 60 * 60);
+
+        // Drops the history and resizes the ring.
+        void configure(size_t bufferBytes, size_t maxFrames);
+        void clear();
+
+        // Call once per emulated frame.
+        void capture(const GBCPU &cpu, const GBMEM &mem);
+        // Restores the frame captured before the last one. False once the
+        // history is used up.
+        bool stepBack(GBCPU &cpu, GBMEM &mem);
+
+        size_t frames() const { return history.size(); }
+        size_t bytesUsed() const { return used; }
+        size_t capacity() const { return ring.size(); }
+
+        // The codec, usable on its own: encode writes the XOR of a and b
+        // (size bytes each) to out, which must hold maxEncodedSize(size),
+        // and returns its length; decode XORs it back into state.
+        static size_t maxEncodedSize(size_t size) { return size + (size / 8 + 1) * 10; }
+        static size_t encode(const uint8_t *a, const uint8_t *b, size_t size, uint8_t *out);
+        static bool decode(const uint8_t *in, size_t length, uint8_t *state, size_t size);
+
+    private:
+        struct Frame {
+            size_t offset;
+            size_t size;
+        };
+
+        void store(const uint8_t *delta, size_t size);
+
+        std::vector<uint8_t> ring;
+        size_t head = 0;
+        size_t used = 0;
+        size_t frameLimit;
+        std::deque<Frame> history;
+
+        // The last captured state, the one being captured and the encoder's
+        // output.
+        std::vector<uint8_t> last;
+        std::vector<uint8_t> current;
+        std::vector<uint8_t> scratch;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cpu/GBCpu.h>
+#include <memory/GBMemory.h>
+#include <cstdint>
+#include <vector>
+
+// Run-ahead hides the frames of input lag a game builds in. Each displayed
+// frame emulates the real frame, saves the machine, runs K more frames with
+// the same input and shows the last of them, then restores the save so the
+// real timeline only ever advanced by one. Only that last frame should put
+// out a picture. Sound comes from the real frame instead: it is the only one
+// that stands, so its sound follows on from the last without a seam.
+//
+// Every extra frame is a whole frame of emulation, so the cost grows with
+// K. It is measured per frame so K can be picked per game: as small as
+// hides the lag, as large as the host keeps up with.
+class RunAhead {
+    public:
+        // Emulates one frame, drawing it only with picture and playing it
+        // only with sound.
+        using FrameFn = void(*)(void *context, bool picture, bool sound);
+
+        explicit RunAhead(unsigned frames = 0) : ahead(frames) {}
+
+        void setFrames(unsigned frames);
+        unsigned frames() const { return ahead; }
+
+        // Advances the machine by one frame and presents the frame K ahead.
+        // False if the restore failed, which leaves the machine ahead.
+        bool runFrame(GBCPU &cpu, GBMEM &mem, FrameFn frame, void *context);
+
+        // What the save, the K frames and the restore cost, for the last
+        // frame and as a running average, and the average of the real frame
+        // alone to compare it with.
+        double lastExtraMicros() const { return lastExtra; }
+        double extraMicros() const { return averageExtra; }
+        double frameMicros() const { return averageFrame; }
+
+    private:
+        unsigned ahead;
+        std::vector<uint8_t> state;
+        double lastExtra = 0;
+        double averageExtra = 0;
+        double averageFrame = 0;
+};
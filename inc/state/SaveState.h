@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cpu/GBCpu.h>
+#include <memory/GBMemory.h>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+// Binary snapshots of a machine. A state is a fixed layout of plain blocks,
+// copied with memcpy both ways:
+//
+//   Header | GBCPU::State | GBMEM::State | cartridge RAM
+//
+// The header records the size of every block, so a state from a build with
+// a different layout is refused instead of misread. A new component appends
+// its block and bumps VERSION. States are native endian and only meant for
+// the build that wrote them and its close relatives.
+//
+// A delta only makes sense on top of its base, a full state that also
+// restarted the bus's write tracking:
+//
+//   Header | GBCPU::State | GBMEM::DeltaState | page count | indices | pages
+//
+// It holds the CPU and the small blocks whole plus the 256 byte pages
+// written since the base, typically a few KB per frame instead of the
+// whole machine. Every delta is against the base, not the previous delta.
+class SaveState {
+    public:
+        static constexpr uint32_t VERSION = 3;
+
+        struct Header {
+            char magic[4];
+            uint32_t version;
+            uint32_t size;          // whole state, header included
+            uint32_t cpuBytes;
+            uint32_t memBytes;
+            uint32_t ramBytes;
+            uint32_t reserved;
+            // The base this state is, or for a delta applies to; 0 if none.
+            uint64_t base;
+        };
+
+        // Everything before the cartridge RAM.
+        struct Fixed {
+            Header header;
+            GBCPU::State cpu;
+            GBMEM::State mem;
+        };
+        static_assert(std::is_trivially_copyable_v<Fixed> && std::is_standard_layout_v<Fixed>);
+
+        static size_t size(const GBMEM &mem) { return sizeof(Fixed) + mem.cartridge().ramSize(); }
+
+        // Writes the state into out, resizing it. Reusing the same buffer
+        // keeps repeated saves free of allocations.
+        static void save(const GBCPU &cpu, const GBMEM &mem, std::vector<uint8_t> &out);
+        // Restores a state saved from the same game. Nothing is touched if
+        // it is refused.
+        static bool load(GBCPU &cpu, GBMEM &mem, const std::vector<uint8_t> &in);
+
+        struct DeltaFixed {
+            Header header;
+            GBCPU::State cpu;
+            GBMEM::DeltaState mem;
+            uint32_t pageCount;
+            uint32_t reserved;
+        };
+        static_assert(std::is_trivially_copyable_v<DeltaFixed> && std::is_standard_layout_v<DeltaFixed>);
+
+        // A full state that later deltas are taken against.
+        static void saveBase(const GBCPU &cpu, GBMEM &mem, std::vector<uint8_t> &out);
+        static void saveDelta(const GBCPU &cpu, const GBMEM &mem, std::vector<uint8_t> &out);
+        // Restores base, then delta over it, and keeps tracking against the
+        // base so further deltas stay valid.
+        static bool loadDelta(GBCPU &cpu, GBMEM &mem, const std::vector<uint8_t> &base,
+                              const std::vector<uint8_t> &delta);
+};
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Hands the newest of a stream of values (frames) from one thread to
+// another. Of three slots the producer owns one to write, the consumer owns
+// one to read and the third is the latest published; publishing and taking
+// each swap their own slot with that one in a single atomic exchange. So
+// neither side ever waits for the other, a value being read is never
+// written over, and a consumer that falls behind skips straight to the
+// newest rather than working through a queue.
+template<typename T>
+class TripleBuffer {
+    public:
+        // Producer side: the slot to fill, then publish() to hand it over.
+        T &back() { return slots[backIndex]; }
+        void publish() {
+            unsigned previous = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel);
+            backIndex = previous & INDEX;
+            // Published and never taken: that value is skipped.
+            if (previous & FRESH) skipped.fetch_add(1, std::memory_order_relaxed);
+            published.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // Consumer side: takes the newest value if one came since the last
+        // take and says whether it did. front() stays valid until the next
+        // take.
+        bool take() {
+            if (!(middle.load(std::memory_order_relaxed) & FRESH)) return false;
+            frontIndex = middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+            return true;
+        }
+        const T &front() const { return slots[frontIndex]; }
+
+        // Values published, and of those the ones replaced before they were
+        // taken; readable from either side.
+        uint64_t publishedCount() const { return published.load(std::memory_order_relaxed); }
+        uint64_t skippedCount() const { return skipped.load(std::memory_order_relaxed); }
+
+    private:
+        static constexpr unsigned INDEX = 3;
+        static constexpr unsigned FRESH = 4;
+
+        T slots[3]{};
+        // Each side's index on its own cache line, as is the shared one;
+        // the counts are the producer's.
+        alignas(64) unsigned backIndex = 0;
+        std::atomic<uint64_t> published{0};
+        std::atomic<uint64_t> skipped{0};
+        alignas(64) std::atomic<unsigned> middle{1};
+        alignas(64) unsigned frontIndex = 2;
+};
@@ -1,15 +1,68 @@
-#include <SDL3/SDL_log.h>
-#include <string>
+#pragma once
+
+#include <cstdarg>
+#include <cstdio>
+
+// Log levels are selected at compile time. Anything above GB_LOG_LEVEL is
+// discarded by the LOG_* macros before its arguments are even evaluated, so
+// a disabled level costs nothing on the hot path.
+#define GB_LOG_LEVEL_NONE  0
+#define GB_LOG_LEVEL_ERROR 1
+#define GB_LOG_LEVEL_INFO  2
+#define GB_LOG_LEVEL_DEBUG 3
+
+#ifndef GB_LOG_LEVEL
+#define GB_LOG_LEVEL GB_LOG_LEVEL_INFO
+#endif
+
+// Per-instruction tracing into the CPU's binary ring buffer. Defaults to on
+// only for debug-level builds.
+#ifndef GB_TRACE
+#define GB_TRACE (GB_LOG_LEVEL >= GB_LOG_LEVEL_DEBUG)
+#endif
+
+#if defined(__GNUC__)
+#define GB_PRINTF_FORMAT(fmt, args) __attribute__((format(printf, fmt, args)))
+#else
+#define GB_PRINTF_FORMAT(fmt, args)
+#endif
 
 class Log {
     public:
-        static void i(std::string log, std::string tag = "NONE") {
-            SDL_Log(("[INFO]  [" + tag + "] " + log).c_str());
-        }
-        static void e(std::string log, std::string tag = "NONE") {
-            SDL_Log(("[ERROR] [" + tag + "] " + log).c_str());
+        enum Level {
+            ERROR = GB_LOG_LEVEL_ERROR,
+            INFO  = GB_LOG_LEVEL_INFO,
+            DEBUG = GB_LOG_LEVEL_DEBUG
+        };
+
+        static constexpr bool enabled(Level level) { return level <= GB_LOG_LEVEL; }
+        static constexpr bool traceEnabled = GB_TRACE;
+
+        // Formatting only happens here, i.e. only for levels that survived
+        // compile-time selection.
+        static void write(Level level, const char *tag, const char *fmt, ...) GB_PRINTF_FORMAT(3, 4) {
+            char buf[512];
+            va_list args;
+            va_start(args, fmt);
+            std::vsnprintf(buf, sizeof(buf), fmt, args);
+            va_end(args);
+            std::fprintf(stderr, "%s [%s] %s\n", prefix(level), tag, buf);
         }
-        static void d(std::string log, std::string tag = "NONE") {
-            SDL_Log(("[DEBUG] [" + tag + "] " + log).c_str());
+
+    private:
+        static constexpr const char *prefix(Level level) {
+            switch (level) {
+                case ERROR: return "[ERROR]";
+                case INFO:  return "[INFO] ";
+                case DEBUG: return "[DEBUG]";
+            }
+            return "";
         }
 };
+
+#define GB_LOG(level, tag, ...) \
+    do { if constexpr (Log::enabled(level)) Log::write(level, tag, __VA_ARGS__); } while (0)
+
+#define LOG_E(tag, ...) GB_LOG(Log::ERROR, tag, __VA_ARGS__)
+#define LOG_I(tag, ...) GB_LOG(Log::INFO,  tag, __VA_ARGS__)
+#define LOG_D(tag, ...) GB_LOG(Log::DEBUG, tag, __VA_ARGS__)
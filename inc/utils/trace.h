@@ -0,0 +1,63 @@
+#pragma once
+
+#include <utils/log.h>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+
+#ifndef GB_TRACE_CAPACITY
+#define GB_TRACE_CAPACITY 4096
+#endif
+
+// One executed instruction, captured before it runs. Kept as a fixed 16 byte
+// POD so recording is a single struct copy; decoding to text is deferred to
+// dump().
+struct TraceRecord {
+    uint16_t pc;
+    uint16_t af, bc, de, hl, sp;
+    uint8_t opcode;
+    uint8_t operand[2];
+    uint8_t pad;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must stay 16 bytes");
+
+void dumpTraceRecord(std::FILE *out, const TraceRecord &record);
+
+// Fixed-size ring of the last N trace records. N must be a power of two.
+template<size_t N>
+class TraceBuffer {
+    static_assert(N && (N & (N - 1)) == 0, "TraceBuffer size must be a power of two");
+    public:
+        void push(const TraceRecord &record) { records[head++ & (N - 1)] = record; }
+        void clear() { head = 0; }
+
+        size_t size() const { return head < N ? head : N; }
+        uint64_t total() const { return head; }
+
+        // Oldest first.
+        const TraceRecord &operator[](size_t i) const {
+            return records[(head - size() + i) & (N - 1)];
+        }
+
+        void dump(std::FILE *out) const {
+            for (size_t i = 0; i < size(); ++i) dumpTraceRecord(out, (*this)[i]);
+        }
+
+    private:
+        std::array<TraceRecord, N> records{};
+        uint64_t head = 0;
+};
+
+// Tracing compiled out: no storage, every call is a no-op.
+template<>
+class TraceBuffer<0> {
+    public:
+        void push(const TraceRecord &) {}
+        void clear() {}
+        size_t size() const { return 0; }
+        uint64_t total() const { return 0; }
+        void dump(std::FILE *) const {}
+};
+
+using CPUTrace = TraceBuffer<Log::traceEnabled ? GB_TRACE_CAPACITY : 0>;
@@ -0,0 +1,285 @@
+#include <apu/GBApu.h>
+#include <cpu/GBCpu.h>
+#include <algorithm>
+
+// The channels' timers run on ticks, four to the CPU's M-cycle.
+static constexpr uint64_t TICKS_PER_CYCLE = 4;
+static constexpr double CLOCK_RATE = double(GBCPU::CYCLES_PER_SECOND * TICKS_PER_CYCLE);
+// The frame sequencer clocks lengths, sweep and envelopes at 512 Hz.
+static constexpr uint64_t SEQUENCER_TICKS = 8192;
+static constexpr uint64_t NEVER = UINT64_MAX;
+// One step of one channel at master volume 1. Four channels at 15 and
+// master volume 8 stay within 16 bits.
+static constexpr int32_t AMPLITUDE = 64;
+
+// Offsets from FF10. Channel n's five registers start at 5n.
+static constexpr unsigned NR10 = 0x00, NR30 = 0x0A, NR32 = 0x0C, NR43 = 0x12;
+static constexpr unsigned NR50 = 0x14, NR51 = 0x15, NR52 = 0x16, WAVE = 0x20;
+static constexpr unsigned nr(unsigned channel, unsigned index) { return 5 * channel + index; }
+
+// Square waveforms, step 0 in the top bit: 12.5%, 25%, 50% and 75% high.
+static constexpr uint8_t DUTY[4] = {0x01, 0x81, 0x87, 0x7E};
+static constexpr uint8_t NOISE_DIVISOR[8] = {8, 16, 32, 48, 64, 80, 96, 112};
+
+GBAPU::GBAPU(unsigned sampleRate) : rate(sampleRate), left(2 * sampleRate), right(2 * sampleRate) {
+    setResampleRatio(1);
+}
+
+void GBAPU::setResampleRatio(double ratio) {
+    stretch = ratio;
+    left.setRates(CLOCK_RATE, rate * ratio);
+    right.setRates(CLOCK_RATE, rate * ratio);
+}
+
+void GBAPU::attach(GBMEM &mem) {
+    mem.recordSound(true);
+    resync(mem);
+}
+
+void GBAPU::resync(const GBMEM &mem) {
+    endFrame();
+    for (unsigned reg = 0; reg < regs.size(); ++reg) regs[reg] = mem.ioRegister(uint16_t(0xFF10 + reg));
+    now = frameStart = mem.now() * TICKS_PER_CYCLE;
+    for (unsigned n = 0; n < channels.size(); ++n) {
+        Channel &c = channels[n];
+        c.on = false;
+        c.dac = n == 2 ? regs[NR30] & 0x80 : regs[nr(n, 2)] & 0xF8;
+        c.frequency = uint16_t((regs[nr(n, 4)] & 7) << 8 | regs[nr(n, 3)]);
+        c.lengthEnabled = regs[nr(n, 4)] & 0x40;
+        c.length = uint16_t(n == 2 ? 256 - regs[nr(2, 1)] : 64 - (regs[nr(n, 1)] & 0x3F));
+        if (regs[NR52] & 0x80 && regs[NR52] >> n & 1) trigger(n, now);
+        else output(n, now);
+    }
+}
+
+void GBAPU::run(GBMEM &mem) {
+    uint64_t target = mem.now() * TICKS_PER_CYCLE;
+    mem.takeSoundWrites(writes);
+    if (target < now) {
+        // A state was loaded; what was logged since is in the registers.
+        resync(mem);
+        return;
+    }
+    for (const GBMEM::SoundWrite &logged: writes) {
+        uint64_t time = std::max(logged.cycle * TICKS_PER_CYCLE, now);
+        advance(time);
+        write(logged.address - 0xFF10u, logged.data, time);
+    }
+    advance(target);
+    endFrame();
+}
+
+size_t GBAPU::readSamples(int16_t *out, size_t frames) {
+    frames = left.read(out, frames, CHANNELS);
+    return right.read(out + 1, frames, CHANNELS);
+}
+
+// Steps of the frame sequencer split the time, and each ends a frame of the
+// step buffers so those never get longer than one step.
+void GBAPU::advance(uint64_t to) {
+    while (now < to) {
+        uint64_t step = (now / SEQUENCER_TICKS + 1) * SEQUENCER_TICKS;
+        uint64_t until = std::min(to, step);
+        for (unsigned n = 0; n < channels.size(); ++n) runChannel(n, until);
+        now = until;
+        if (now == step) {
+            clockSequencer(unsigned(step / SEQUENCER_TICKS) & 7, now);
+            endFrame();
+        }
+    }
+}
+
+void GBAPU::runChannel(unsigned n, uint64_t to) {
+    Channel &c = channels[n];
+    if (!c.on || c.nextEdge >= to) return;
+    uint64_t step = period(n);
+    if (step == NEVER) {
+        c.nextEdge = NEVER;
+        return;
+    }
+    // Squares and the wave at volume 0 are silent wherever they are, so
+    // they skip straight to the end.
+    bool silent = n == 2 ? !(regs[NR32] & 0x60) : n != 3 && !c.volume;
+    if (silent) {
+        uint64_t edges = (to - c.nextEdge + step - 1) / step;
+        c.position = uint8_t((c.position + edges) & (n == 2 ? 31 : 7));
+        c.nextEdge += edges * step;
+        return;
+    }
+    for (; c.nextEdge < to; c.nextEdge += step) {
+        if (n == 3) {
+            unsigned bit = (lfsr ^ lfsr >> 1) & 1;
+            lfsr = uint16_t(lfsr >> 1 | bit << 14);
+            if (regs[NR43] & 0x08) lfsr = uint16_t((lfsr & ~0x40) | bit << 6);
+        } else {
+            c.position = (c.position + 1) & (n == 2 ? 31 : 7);
+        }
+        output(n, c.nextEdge);
+    }
+}
+
+// Lengths on even steps, the sweep on 2 and 6, envelopes on 7.
+void GBAPU::clockSequencer(unsigned step, uint64_t time) {
+    if (!(step & 1)) {
+        for (unsigned n = 0; n < channels.size(); ++n) {
+            Channel &c = channels[n];
+            if (!c.lengthEnabled || !c.length || --c.length || !c.on) continue;
+            c.on = false;
+            output(n, time);
+        }
+    }
+    if (step == 2 || step == 6) clockSweep(time);
+    if (step != 7) return;
+    for (unsigned n: {0u, 1u, 3u}) {
+        Channel &c = channels[n];
+        if (!c.on || !c.envelopePeriod || --c.envelopeTimer) continue;
+        c.envelopeTimer = c.envelopePeriod;
+        if (c.envelopeUp ? c.volume == 15 : c.volume == 0) continue;
+        c.volume = uint8_t(c.envelopeUp ? c.volume + 1 : c.volume - 1);
+        output(n, time);
+    }
+}
+
+void GBAPU::clockSweep(uint64_t time) {
+    if (--sweepTimer) return;
+    unsigned sweepPeriod = regs[NR10] >> 4 & 7;
+    sweepTimer = uint8_t(sweepPeriod ? sweepPeriod : 8);
+    if (!sweepEnabled || !sweepPeriod) return;
+    uint16_t target = sweepTarget();
+    if (target <= 0x7FF && (regs[NR10] & 7)) {
+        sweepFrequency = channels[0].frequency = target;
+        target = sweepTarget();
+    }
+    if (target > 0x7FF) {
+        channels[0].on = false;
+        output(0, time);
+    }
+}
+
+uint16_t GBAPU::sweepTarget() const {
+    uint16_t change = sweepFrequency >> (regs[NR10] & 7);
+    return uint16_t(regs[NR10] & 0x08 ? sweepFrequency - change : sweepFrequency + change);
+}
+
+// The bus has already dropped what the power being off ignores.
+void GBAPU::write(unsigned reg, uint8_t data, uint64_t time) {
+    regs[reg] = data;
+    if (reg >= WAVE) return;
+    if (reg == NR52) {
+        if (data & 0x80) return;
+        std::fill(regs.begin(), regs.begin() + NR52 + 1, 0);
+        for (unsigned n = 0; n < channels.size(); ++n) {
+            channels[n] = Channel{.left = channels[n].left, .right = channels[n].right};
+            output(n, time);
+        }
+        return;
+    }
+    if (reg == NR50 || reg == NR51) {
+        for (unsigned n = 0; n < channels.size(); ++n) output(n, time);
+        return;
+    }
+    if (reg > NR50) return;
+
+    unsigned n = reg / 5;
+    Channel &c = channels[n];
+    switch (reg % 5) {
+        case 0:
+            if (reg != NR30) break;
+            c.dac = data & 0x80;
+            c.on &= c.dac;
+            output(n, time);
+            break;
+        case 1:
+            c.length = uint16_t(n == 2 ? 256 - data : 64 - (data & 0x3F));
+            output(n, time);
+            break;
+        case 2:
+            if (n != 2) {
+                c.dac = data & 0xF8;
+                c.on &= c.dac;
+            }
+            output(n, time);
+            break;
+        case 3:
+            if (n == 3) {
+                uint64_t step = period(3);
+                c.nextEdge = step == NEVER ? NEVER : time + step;
+            } else {
+                c.frequency = uint16_t((c.frequency & 0x700) | data);
+            }
+            break;
+        case 4:
+            if (n != 3) c.frequency = uint16_t((c.frequency & 0xFF) | (data & 7) << 8);
+            c.lengthEnabled = data & 0x40;
+            if (data & 0x80) trigger(n, time);
+            break;
+    }
+}
+
+void GBAPU::trigger(unsigned n, uint64_t time) {
+    Channel &c = channels[n];
+    c.on = c.dac;
+    if (!c.length) c.length = n == 2 ? 256 : 64;
+    uint64_t step = period(n);
+    c.nextEdge = step == NEVER ? NEVER : time + step;
+    if (n == 2) {
+        c.position = 0;
+    } else {
+        uint8_t envelope = regs[nr(n, 2)];
+        c.volume = envelope >> 4;
+        c.envelopePeriod = envelope & 7;
+        c.envelopeTimer = c.envelopePeriod;
+        c.envelopeUp = envelope & 0x08;
+    }
+    if (n == 3) lfsr = 0x7FFF;
+    if (n == 0) {
+        unsigned sweepPeriod = regs[NR10] >> 4 & 7;
+        sweepFrequency = c.frequency;
+        sweepTimer = uint8_t(sweepPeriod ? sweepPeriod : 8);
+        sweepEnabled = sweepPeriod || (regs[NR10] & 7);
+        if ((regs[NR10] & 7) && sweepTarget() > 0x7FF) c.on = false;
+    }
+    output(n, time);
+}
+
+// Ticks between waveform steps: a duty step, a wave sample, a noise shift.
+uint64_t GBAPU::period(unsigned n) const {
+    if (n == 3) {
+        unsigned shift = regs[NR43] >> 4;
+        return shift >= 14 ? NEVER : uint64_t(NOISE_DIVISOR[regs[NR43] & 7]) << shift;
+    }
+    return uint64_t(2048 - channels[n].frequency) * (n == 2 ? 2 : 4);
+}
+
+// The channel's DAC input, 0-15.
+uint8_t GBAPU::level(unsigned n) const {
+    const Channel &c = channels[n];
+    if (!c.on) return 0;
+    if (n == 2) {
+        unsigned code = regs[NR32] >> 5 & 3;
+        if (!code) return 0;
+        uint8_t pair = regs[WAVE + c.position / 2];
+        return uint8_t((c.position & 1 ? pair & 0x0F : pair >> 4) >> (code - 1));
+    }
+    if (n == 3) return lfsr & 1 ? 0 : c.volume;
+    return DUTY[regs[nr(n, 1)] >> 6] >> (7 - c.position) & 1 ? c.volume : 0;
+}
+
+// Puts the channel's level, through the panning and master volume, into
+// the step buffers as the change from what it was adding.
+void GBAPU::output(unsigned n, uint64_t time) {
+    Channel &c = channels[n];
+    int32_t amplitude = level(n) * AMPLITUDE;
+    int32_t toLeft = regs[NR51] >> (4 + n) & 1 ? amplitude * ((regs[NR50] >> 4 & 7) + 1) : 0;
+    int32_t toRight = regs[NR51] >> n & 1 ? amplitude * ((regs[NR50] & 7) + 1) : 0;
+    if (toLeft != c.left) left.addDelta(time - frameStart, toLeft - c.left);
+    if (toRight != c.right) right.addDelta(time - frameStart, toRight - c.right);
+    c.left = toLeft;
+    c.right = toRight;
+}
+
+void GBAPU::endFrame() {
+    dropped += left.endFrame(now - frameStart);
+    right.endFrame(now - frameStart);
+    frameStart = now;
+}
@@ -0,0 +1,81 @@
+#include <apu/BlipBuffer.h>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+
+// Pass band of the sinc as a fraction of the output's Nyquist frequency;
+// the short kernel needs the rest to roll off in.
+static constexpr double CUTOFF = 0.9;
+
+// A Blackman windowed sinc per phase of the step within a sample, rounded
+// so every phase sums to exactly one and a step integrates to its delta.
+const BlipBuffer::Kernel *BlipBuffer::kernels() {
+    static const struct Table {
+        Kernel kernel[PHASES];
+
+        Table() {
+            constexpr double HALF = TAPS / 2.0;
+            constexpr double PI = std::numbers::pi;
+            for (unsigned phase = 0; phase < PHASES; ++phase) {
+                double taps[TAPS], sum = 0;
+                for (unsigned tap = 0; tap < TAPS; ++tap) {
+                    // The step sits between the middle two taps.
+                    double x = tap - (HALF - 1) - double(phase) / PHASES;
+                    double sinc = x ? std::sin(PI * CUTOFF * x) / (PI * x) : CUTOFF;
+                    double window = 0.42 + 0.5 * std::cos(PI * x / HALF) + 0.08 * std::cos(2 * PI * x / HALF);
+                    taps[tap] = sinc * window;
+                    sum += taps[tap];
+                }
+                int total = 0;
+                for (unsigned tap = 0; tap < TAPS; ++tap) {
+                    kernel[phase][tap] = int16_t(std::lround(taps[tap] / sum * (1 << KERNEL_BITS)));
+                    total += kernel[phase][tap];
+                }
+                kernel[phase][TAPS / 2 - 1] += int16_t((1 << KERNEL_BITS) - total);
+            }
+        }
+    } table;
+    return table.kernel;
+}
+
+BlipBuffer::BlipBuffer(size_t capacity) : limit(capacity), deltas(capacity + FRAME_SAMPLES + TAPS, 0) {}
+
+void BlipBuffer::setRates(double clockRate, double sampleRate) {
+    outputRate = sampleRate;
+    factor = uint64_t(std::llround(sampleRate / clockRate * double(uint64_t(1) << FRACTION_BITS)));
+}
+
+size_t BlipBuffer::endFrame(uint64_t time) {
+    offset += time * factor;
+    size_t excess = samplesAvailable() > limit ? samplesAvailable() - limit : 0;
+    if (excess) read(nullptr, excess);
+    return excess;
+}
+
+size_t BlipBuffer::read(int16_t *out, size_t count, size_t stride) {
+    size_t available = samplesAvailable();
+    count = std::min(count, available);
+    int32_t sum = integrator;
+    for (size_t i = 0; i < count; ++i) {
+        int32_t sample = std::clamp(sum >> KERNEL_BITS, -32768, 32767);
+        if (out) out[i * stride] = int16_t(sample);
+        sum += deltas[i];
+        sum -= sample << (KERNEL_BITS - BASS_SHIFT);
+    }
+    integrator = sum;
+
+    // Keeps the rest, with the tails of its steps and anything already
+    // added to the next frame.
+    size_t left = std::min(available - count + FRAME_SAMPLES + TAPS, deltas.size() - count);
+    std::memmove(deltas.data(), deltas.data() + count, left * sizeof(int32_t));
+    std::fill(deltas.begin() + left, deltas.begin() + left + count, 0);
+    offset -= uint64_t(count) << FRACTION_BITS;
+    return count;
+}
+
+void BlipBuffer::clear() {
+    std::fill(deltas.begin(), deltas.end(), 0);
+    offset = 0;
+    integrator = 0;
+}
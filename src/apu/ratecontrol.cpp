@@ -0,0 +1,29 @@
+#include <apu/RateControl.h>
+#include <algorithm>
+
+// Weight of the newest level in the smoothed one. The device reads in
+// chunks of several frames' worth, so single readings jump.
+static constexpr double SMOOTHING = 1.0 / 8;
+// Share of the deviation given per frame by a queue that is off by its
+// whole target, for the proportional and integral terms. The integral term
+// alone would cover the whole deviation after 400 such frames.
+static constexpr double PROPORTIONAL = 1.0;
+static constexpr double INTEGRAL = 1.0 / 400;
+
+RateControl::RateControl(size_t targetFrames, double maxDeviation) : goal(targetFrames), deviation(maxDeviation) {}
+
+double RateControl::update(size_t queued) {
+    smoothed = smoothed < 0 ? double(queued) : smoothed + (double(queued) - smoothed) * SMOOTHING;
+    double error = goal ? std::clamp((double(goal) - smoothed) / double(goal), -1.0, 1.0) : 0.0;
+    // The integral stays within what the ratio can give, so it does not
+    // wind up while the queue is far off.
+    integral = std::clamp(integral + INTEGRAL * error, -1.0, 1.0);
+    current = 1 + deviation * std::clamp(PROPORTIONAL * error + integral, -1.0, 1.0);
+    return current;
+}
+
+void RateControl::reset() {
+    smoothed = -1;
+    integral = 0;
+    current = 1;
+}
@@ -0,0 +1,46 @@
+#include <apu/SampleRing.h>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+SampleRing::SampleRing(size_t frames) : buffer(std::bit_ceil(std::max<size_t>(frames, 2)) * CHANNELS),
+                                        mask(buffer.size() / CHANNELS - 1) {}
+
+static constexpr size_t CHANNELS = SampleRing::CHANNELS;
+static constexpr size_t FRAME_BYTES = CHANNELS * sizeof(int16_t);
+
+// Copies frames between the ring, from frame index at on, and flat memory,
+// in at most two pieces.
+static void copyIn(int16_t *ring, size_t mask, size_t at, const int16_t *from, size_t frames) {
+    size_t start = at & mask;
+    size_t first = std::min(frames, mask + 1 - start);
+    std::memcpy(ring + start * CHANNELS, from, first * FRAME_BYTES);
+    std::memcpy(ring, from + first * CHANNELS, (frames - first) * FRAME_BYTES);
+}
+
+static void copyOut(const int16_t *ring, size_t mask, size_t at, int16_t *to, size_t frames) {
+    size_t start = at & mask;
+    size_t first = std::min(frames, mask + 1 - start);
+    std::memcpy(to, ring + start * CHANNELS, first * FRAME_BYTES);
+    std::memcpy(to + first * CHANNELS, ring, (frames - first) * FRAME_BYTES);
+}
+
+size_t SampleRing::write(const int16_t *samples, size_t frames) {
+    size_t at = head.load(std::memory_order_relaxed);
+    if (capacity() - (at - tailSeen) < frames) tailSeen = tail.load(std::memory_order_acquire);
+    frames = std::min(frames, capacity() - (at - tailSeen));
+    if (!frames) return 0;
+    copyIn(buffer.data(), mask, at, samples, frames);
+    head.store(at + frames, std::memory_order_release);
+    return frames;
+}
+
+size_t SampleRing::read(int16_t *samples, size_t frames) {
+    size_t at = tail.load(std::memory_order_relaxed);
+    if (headSeen - at < frames) headSeen = head.load(std::memory_order_acquire);
+    frames = std::min(frames, headSeen - at);
+    if (!frames) return 0;
+    copyOut(buffer.data(), mask, at, samples, frames);
+    tail.store(at + frames, std::memory_order_release);
+    return frames;
+}
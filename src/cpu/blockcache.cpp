@@ -0,0 +1,58 @@
+#include <cpu/BlockCache.h>
+#include <algorithm>
+
+Block *BlockCache::insert(GBMEM &mem, std::unique_ptr<Block> block) {
+    Block *raw = block.get();
+    uint8_t first = raw->start >> 8;
+    uint8_t last = (raw->end - 1) >> 8;
+    for (unsigned page = first; ; page = (page + 1) & 0xFF) {
+        pageBlocks[page].push_back(raw);
+        mem.markCode(page);
+        if (page == last) break;
+    }
+    blocks[key(raw->bank, raw->start)] = std::move(block);
+    lookup(raw->start) = raw;
+    return raw;
+}
+
+Block *BlockCache::refind(uint16_t address, uint16_t bank) {
+    auto it = blocks.find(key(bank, address));
+    if (it == blocks.end()) return nullptr;
+    return lookup(address) = it->second.get();
+}
+
+void BlockCache::sync(GBMEM &mem) {
+    if (mem.codeWriteCount() == syncedWrites) return;
+    syncedWrites = mem.codeWriteCount();
+    std::bitset<256> stale = mem.takeStaleCode();
+    if (stale.none()) return;
+    for (unsigned page = 0; page < 256; ++page) {
+        if (stale[page]) invalidatePage(page);
+    }
+}
+
+void BlockCache::invalidatePage(uint8_t page) {
+    std::vector<Block*> victims;
+    victims.swap(pageBlocks[page]);
+    for (Block *block: victims) {
+        // A block spanning two pages is also listed on the other one.
+        uint8_t first = block->start >> 8;
+        uint8_t last = (block->end - 1) >> 8;
+        for (uint8_t other: {first, last}) {
+            if (other == page) continue;
+            auto &list = pageBlocks[other];
+            list.erase(std::remove(list.begin(), list.end(), block), list.end());
+        }
+        Block *&fast = lookup(block->start);
+        if (fast == block) fast = nullptr;
+        if (block->native) ++nativeInvalidated;
+        blocks.erase(key(block->bank, block->start));
+        ++invalidated;
+    }
+}
+
+void BlockCache::clear() {
+    blocks.clear();
+    for (auto &page: fastLookup) page.reset();
+    for (auto &list: pageBlocks) list.clear();
+}
@@ -1,974 +1,1064 @@
 #include <cpu/GBCpu.h>
 #include <memory/GBMemory.h>
 #include <utils/log.h>
+#include <algorithm>
+#include <bit>
 #include <cstdint>
-#include <string>
 
 using Handler = uint16_t(GBCPU::*)(GBMEM&, uint16_t);
-static constexpr std::array<Handler, 256> decodeTable = GBCPU::makeDecodeTable();
+static constexpr std::array<Handler, 256> decodeTable =
+    GBCPU::makeDecodeTable(std::make_index_sequence<256>());
+static constexpr std::array<Handler, 256> cbDecodeTable =
+    GBCPU::makeCBDecodeTable(std::make_index_sequence<256>());
 constexpr const char *LOG_TAG = "GBCPU";
 
+// M-cycles per opcode, not-taken cost for conditional branches. Only used
+// to budget whole predecoded blocks; the handlers charge the real cost.
+// CB is 0 here since its cost depends on the second byte (cbCycles).
+static constexpr std::array<uint8_t, 256> opcodeCycles = {
+    1, 3, 2, 2, 1, 1, 2, 1, 5, 2, 2, 2, 1, 1, 2, 1,
+    1, 3, 2, 2, 1, 1, 2, 1, 3, 2, 2, 2, 1, 1, 2, 1,
+    2, 3, 2, 2, 1, 1, 2, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+    2, 3, 2, 2, 3, 3, 3, 1, 2, 2, 2, 2, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    2, 2, 2, 2, 2, 2, 1, 2, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    1, 1, 1, 1, 1, 1, 2, 1, 1, 1, 1, 1, 1, 1, 2, 1,
+    2, 3, 3, 4, 3, 4, 2, 4, 2, 4, 3, 0, 3, 6, 2, 4,
+    2, 3, 3, 1, 3, 4, 2, 4, 2, 4, 3, 1, 3, 1, 2, 4,
+    3, 3, 2, 1, 1, 4, 2, 4, 4, 1, 4, 1, 1, 1, 2, 4,
+    3, 3, 2, 1, 1, 4, 2, 4, 3, 2, 4, 1, 1, 1, 2, 4,
+};
+
+static constexpr uint8_t cbCycles(uint8_t cb) {
+    if ((cb & 0b111) != 0b110) return 2;
+    return (cb & 0b11000000) == 0b01000000 ? 3 : 4;
+}
+
 uint16_t GBCPU::parseInstruction(GBMEM& mem, uint16_t address) {
     uint8_t inst = mem.read8(address);
+    traceInstruction(mem, address, inst);
+    ++instructions;
     return (this->*decodeTable[inst])(mem, address);
 }
 
-uint16_t GBCPU::handleInvalid(GBMEM& mem, uint16_t address) {
-    SDL_Log("[ERROR] [GBCPU] INVALID OPCODE %i RECEIVED AT %i", mem.read8(address), address);
-    return address + 1;
+void GBCPU::saveState(State &state) const {
+    state = {AF(), bc, de, hl, sp, pc, IME, IME_scheduled, halted, 0, cycles, instructions};
+}
+
+void GBCPU::loadState(const State &state) {
+    AF(state.af);
+    bc = state.bc;
+    de = state.de;
+    hl = state.hl;
+    sp = state.sp;
+    pc = state.pc;
+    IME = state.ime;
+    IME_scheduled = state.imeScheduled;
+    halted = state.halted;
+    cycles = state.cycles;
+    instructions = state.instructions;
+    // The shadow ran from the old state.
+    dynarec.endLockstep();
+}
+
+// The dispatchers run to the next event or until an interrupt can be
+// taken, whichever comes first; in between, the events that fell due run
+// and the interrupt is taken. While halted the clock goes from one event to
+// the next without dispatching at all. None of this is replayed by the
+// lockstep shadow, so it starts again from the result.
+uint64_t GBCPU::run(GBMEM& mem, uint64_t cycleBudget, Dispatch dispatch) {
+    uint64_t start = cycles, end = start + cycleBudget;
+    mem.setClock(&cycles);
+    mem.setDeadline(&runUntil);
+    while (cycles < end) {
+        if (mem.nextEvent() <= cycles && mem.runEvents()) dynarec.endLockstep();
+        if (halted) {
+            dynarec.endLockstep();
+            if (!mem.pendingInterrupts()) {
+                skipTo(std::min(end, mem.nextEvent()));
+                continue;
+            }
+            halted = false;
+        }
+        if (interruptPending(mem)) {
+            takeInterrupt(mem);
+            dynarec.endLockstep();
+            continue;
+        }
+        if (IME_scheduled) {
+            // The instruction after EI, with no budget so it cannot skip
+            // ahead. A DI there cancels the enable.
+            dynarec.endLockstep();
+            runUntil = cycles;
+            pc = parseInstruction(mem, pc);
+            if (IME_scheduled) IME = true;
+            IME_scheduled = 0;
+            continue;
+        }
+        runUntil = std::min(end, mem.nextEvent());
+        if (dispatch == Dispatch::Threaded && threadedDispatch) {
+            runThreaded(mem);
+        } else if (dispatch == Dispatch::Block) {
+            runBlocks(mem);
+        } else if (dispatch == Dispatch::Dynarec) {
+            runDynarec(mem);
+        } else {
+            runTable(mem);
+        }
+    }
+    return cycles - start;
+}
+
+// A loop that only loads a byte into A, tests it and branches back, like
+//     LDH A,(LY) / CP 144 / JR NZ
+// ends every pass with the same A and flags for as long as that byte holds
+// still, and nothing else can change before runUntil. So the passes that
+// would read the same value and end by runUntil are counted instead of
+// run, leaving exactly the state running them gives.
+void GBCPU::skipPollLoop(GBMEM& mem, uint16_t head, uint16_t branch) {
+    uint16_t source;
+    uint16_t at = head;
+    uint64_t period = 3;   // the branch back
+    switch (mem.read8(at)) {
+        case 0xF0: source = 0xFF00 | mem.read8(at + 1); at += 2; period += 3; break;  // LDH A,(n)
+        case 0xF2: source = 0xFF00 | C(); at += 1; period += 2; break;                // LDH A,(C)
+        case 0xFA: source = mem.read16(at + 1); at += 3; period += 4; break;          // LD A,(nn)
+        default: return;
+    }
+    // CP n, AND n, AND A or OR A, then the branch.
+    uint8_t test = mem.read8(at), operand = mem.read8(at + 1);
+    bool immediate = test == 0xFE || test == 0xE6;
+    if (!immediate && test != 0xA7 && test != 0xB7) return;
+    if (at + (immediate ? 2 : 1) != branch) return;
+    period += immediate ? 2 : 1;
+
+    uint64_t steady = mem.steadyUntil(source);
+    if (steady <= cycles || runUntil <= cycles) return;
+    uint64_t passes = (runUntil - cycles) / period;
+    if (steady != GBMEM::NEVER) passes = std::min(passes, (steady - cycles + period - 1) / period);
+    if (!passes) return;
+
+    // Only a loop the value keeps going round.
+    uint8_t value = mem.read8(source);
+    bool zero = test == 0xFE ? value == operand : !(test == 0xE6 ? value & operand : value);
+    bool carry = test == 0xFE && value < operand;
+    uint8_t jump = mem.read8(branch);
+    if ((jump & 0x10 ? carry : zero) != bool(jump & 0x08)) return;
+
+    A(value);
+    if (test == 0xFE) cpA(operand);
+    else if (test == 0xE6) andA(operand);
+    else if (test == 0xA7) andA(value);
+    else orA(value);
+    instructions += 3 * passes;
+    skipTo(cycles + passes * period);
+}
+
+// Pushes PC and jumps to the highest priority (lowest) interrupt's vector.
+void GBCPU::takeInterrupt(GBMEM& mem) {
+    uint8_t interrupt = mem.pendingInterrupts() & -mem.pendingInterrupts();
+    mem.acknowledgeInterrupt(interrupt);
+    IME = false;
+    push16(mem, pc);
+    pc = uint16_t(0x40 + 8 * std::countr_zero(interrupt));
+    cycles += 5;
+    ++interrupts;
 }
 
-uint16_t GBCPU::readR16(R16 reg) {
-    switch (reg) {
-        case r16_BC: return BC();
-        case r16_DE: return DE();
-        case r16_HL: return HL();
-        case r16_SP: return SP;
+void GBCPU::runTable(GBMEM& mem) {
+    uint16_t address = pc;
+    while (cycles < runUntil && !interruptPending(mem)) {
+        address = parseInstruction(mem, address);
+    }
+    pc = address;
+}
+
+Block *GBCPU::compileBlock(GBMEM& mem, uint16_t address) {
+    // Code running from OAM or I/O registers is left to the interpreter.
+    if (address >= 0xFE00 && address < 0xFF80) return nullptr;
+
+    auto block = std::make_unique<Block>();
+    block->start = address;
+    block->bank = mem.bankOf(address);
+    uint32_t at = address;
+    while (block->entries.size() < BlockCache::MAX_BLOCK_INSTRUCTIONS) {
+        uint8_t opcode = mem.read8(at);
+        Inst inst = decode(instructionList, opcode);
+        uint8_t length = instLength(opcode);
+        // Stay inside one 16 KB region so the whole block has one bank.
+        if (((at + length - 1) ^ address) & 0x1C000) break;
+        if (inst == CB) {
+            uint8_t cb = mem.read8(at + 1);
+            block->entries.push_back({cbDecodeTable[cb], uint16_t(at + 1), uint16_t(at + 2), opcode});
+            block->cycles += cbCycles(cb);
+        } else {
+            block->entries.push_back({decodeTable[opcode], uint16_t(at), uint16_t(at + length), opcode});
+            block->cycles += opcodeCycles[opcode];
+        }
+        at += length;
+        if (endsBlock(inst)) break;
+    }
+    if (block->entries.empty()) return nullptr;
+    block->end = at;
+    return blockCache.insert(mem, std::move(block));
+}
+
+uint16_t GBCPU::runBlock(GBMEM& mem, const Block &block) {
+    uint16_t address = block.start;
+    uint32_t codeWrites = mem.codeWriteCount();
+    for (const Block::Entry &entry: block.entries) {
+        if constexpr (Log::traceEnabled) {
+            uint16_t at = entry.opcode == 0xCB ? entry.address - 1 : entry.address;
+            traceInstruction(mem, at, entry.opcode);
+        }
+        ++instructions;
+        address = (this->*entry.handler)(mem, entry.address);
+        // A store into cached code may have rewritten the rest of the
+        // block; leave it so the next sync drops it.
+        if (address != entry.next || mem.codeWriteCount() != codeWrites) break;
     }
+    return address;
+}
+
+void GBCPU::runBlocks(GBMEM& mem) {
+    uint16_t address = pc;
+    while (cycles < runUntil && !interruptPending(mem)) {
+        blockCache.sync(mem);
+        Block *block = blockCache.find(mem, address);
+        if (!block) block = compileBlock(mem, address);
+        if (!block || cycles + block->cycles > runUntil) {
+            address = parseInstruction(mem, address);
+            continue;
+        }
+        address = runBlock(mem, *block);
+    }
+    pc = address;
 }
 
-void GBCPU::storeR16(R16 reg, uint16_t val) {
-    switch (reg) {
-        case r16_BC: BC(val);
-        case r16_DE: DE(val);
-        case r16_HL: HL(val);
-        case r16_SP: SP = val;
-    }
+GBCPU::Thunk GBCPU::thunkFor(uint8_t opcode, uint8_t cb) {
+    static constexpr auto thunks = []<size_t... i>(std::index_sequence<i...>) {
+        return std::array<Thunk, 256>{&GBCPU::thunk<decodeTable[i]>...};
+    }(std::make_index_sequence<256>());
+    static constexpr auto cbThunks = []<size_t... i>(std::index_sequence<i...>) {
+        return std::array<Thunk, 256>{&GBCPU::thunk<cbDecodeTable[i]>...};
+    }(std::make_index_sequence<256>());
+    return opcode == 0xCB ? cbThunks[cb] : thunks[opcode];
 }
 
-uint8_t GBCPU::readR8(R8 reg) {
-    switch (reg) {
-        case r8_A:  return A();
-        case r8_B:  return B();
-        case r8_C:  return C();
-        case r8_D:  return D();
-        case r8_E:  return E();
-        case r8_H:  return H();
-        case r8_L:  return L();
-        case r8_HL: return HL();
+void GBCPU::runDynarec(GBMEM& mem) {
+    // Translated blocks do not feed the instruction trace.
+    if (!Dynarec::available || Log::traceEnabled) {
+        runBlocks(mem);
+        return;
     }
-}
 
-void GBCPU::storeR8(R8 reg, uint8_t val) {
-    switch (reg) {
-        case r8_A:  A(val);
-        case r8_B:  B(val);
-        case r8_C:  C(val);
-        case r8_D:  D(val);
-        case r8_E:  E(val);
-        case r8_H:  H(val);
-        case r8_L:  L(val);
-        case r8_HL: HL(val);
+    uint16_t address = pc;
+    if (dynarec.lockstepEnabled() && !dynarec.lockstepActive()) dynarec.beginLockstep(*this, mem);
+    while (cycles < runUntil && !interruptPending(mem)) {
+        if (dynarec.exhausted()) {
+            blockCache.clear();
+            dynarec.flush();
+        }
+        blockCache.sync(mem);
+        dynarec.sync(blockCache, mem);
+        Block *block = blockCache.find(mem, address);
+        if (!block) block = compileBlock(mem, address);
+        if (!block || cycles + block->cycles > runUntil) {
+            address = parseInstruction(mem, address);
+            continue;
+        }
+
+        if (!block->native && !block->interpretOnly && ++block->heat >= Dynarec::HOT_THRESHOLD) {
+            dynarec.translate(*this, mem, blockCache, *block);
+        }
+        if (!block->native) {
+            address = runBlock(mem, *block);
+            continue;
+        }
+
+        // Linked blocks may run past this one; runUntil is checked before
+        // every link so it overshoots by at most one block.
+        address = block->native(this, &mem);
+        if (dynarec.lockstepActive()) dynarec.checkLockstep(*this, mem, address);
     }
+    pc = address;
+}
+
+#define GB_REPEAT16(X, hi) \
+    X(0x##hi##0) X(0x##hi##1) X(0x##hi##2) X(0x##hi##3) \
+    X(0x##hi##4) X(0x##hi##5) X(0x##hi##6) X(0x##hi##7) \
+    X(0x##hi##8) X(0x##hi##9) X(0x##hi##A) X(0x##hi##B) \
+    X(0x##hi##C) X(0x##hi##D) X(0x##hi##E) X(0x##hi##F)
+#define GB_REPEAT256(X) \
+    GB_REPEAT16(X, 0) GB_REPEAT16(X, 1) GB_REPEAT16(X, 2) GB_REPEAT16(X, 3) \
+    GB_REPEAT16(X, 4) GB_REPEAT16(X, 5) GB_REPEAT16(X, 6) GB_REPEAT16(X, 7) \
+    GB_REPEAT16(X, 8) GB_REPEAT16(X, 9) GB_REPEAT16(X, A) GB_REPEAT16(X, B) \
+    GB_REPEAT16(X, C) GB_REPEAT16(X, D) GB_REPEAT16(X, E) GB_REPEAT16(X, F)
+
+#if defined(__GNUC__)
+// Direct threading: every opcode body ends in its own fetch and indirect
+// jump, so the branch predictor sees 256 jump sites instead of one.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+void GBCPU::runThreaded(GBMEM& mem) {
+    #define GB_LABEL_ADDRESS(n) &&op_##n,
+    static void *const labels[256] = { GB_REPEAT256(GB_LABEL_ADDRESS) };
+    #undef GB_LABEL_ADDRESS
+
+    uint16_t address = pc;
+    uint64_t retired = 0;
+    uint8_t inst;
+    #define GB_DISPATCH()                                           \
+        if (cycles >= runUntil || interruptPending(mem)) goto done; \
+        inst = mem.read8(address);                                  \
+        traceInstruction(mem, address, inst);                       \
+        ++retired;                                                  \
+        goto *labels[inst];
+
+    GB_DISPATCH();
+
+    #define GB_OP_LABEL(n)                                           \
+        op_##n: {                                                    \
+            constexpr Handler handler = decodeTable[n];              \
+            address = (this->*handler)(mem, address);                \
+            GB_DISPATCH();                                           \
+        }
+    GB_REPEAT256(GB_OP_LABEL)
+    #undef GB_OP_LABEL
+    #undef GB_DISPATCH
+
+done:
+    pc = address;
+    instructions += retired;
+}
+#pragma GCC diagnostic pop
+#else
+void GBCPU::runThreaded(GBMEM& mem) {
+    runTable(mem);
 }
+#endif
 
-bool GBCPU::hasCond(COND cond) {
-    switch (cond) {
-        case cond_NZ: return !hasZ();
-        case cond_Z: return hasZ();
-        case cond_NC: return !hasC();
-        case cond_C: return hasC();
-    }
+uint16_t GBCPU::handleInvalid(GBMEM& mem, uint16_t address) {
+    LOG_E(LOG_TAG, "INVALID OPCODE %02X RECEIVED AT %04X", mem.read8(address), address);
+    traceBuffer.dump(stderr);
+    cycles += 1;
+    return address + 1;
+}
+
+void GBCPU::addA(uint8_t val, uint8_t carry) {
+    uint8_t a = A();
+    uint32_t result = a + val + carry;
+    A(result);
+    lazyFlags(FlagOp::Add, 0, a, val, result);
+}
+
+void GBCPU::subA(uint8_t val, uint8_t carry) {
+    uint8_t a = A();
+    // Borrows wrap around, so C is still result > 0xFF.
+    uint32_t result = uint32_t(a) - val - carry;
+    A(result);
+    lazyFlags(FlagOp::Sub, n, a, val, result);
+}
+
+void GBCPU::andA(uint8_t val) {
+    uint8_t result = A() & val;
+    A(result);
+    lazyFlags(FlagOp::Logic, h, 0, 0, result);
+}
+
+void GBCPU::xorA(uint8_t val) {
+    uint8_t result = A() ^ val;
+    A(result);
+    lazyFlags(FlagOp::Logic, 0, 0, 0, result);
+}
+
+void GBCPU::orA(uint8_t val) {
+    uint8_t result = A() | val;
+    A(result);
+    lazyFlags(FlagOp::Logic, 0, 0, 0, result);
+}
+
+void GBCPU::cpA(uint8_t val) {
+    uint8_t a = A();
+    lazyFlags(FlagOp::Sub, n, a, val, uint32_t(a) - val);
 }
 
 // ----------------------------
 //          BLOCK 0
 // ----------------------------
+template<uint8_t opcode>
 uint16_t GBCPU::handleNOP(GBMEM&, uint16_t address) {
-    Log::d("NOP Instruction", LOG_TAG);
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDR16IMM16(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R16 reg = static_cast<R16>((inst & 0b00110000) >> 4);
-    uint16_t val = mem.read16(address + 1);
-    storeR16(reg, val);
-    Log::d("LDR16IMM16: Load " + std::to_string(val) + 
-           " into r16 " + std::to_string(reg), LOG_TAG);
+    constexpr R16 reg = r16(opcode);
+    storeR16<reg>(mem.read16(address + 1));
+    cycles += 3;
     return address + 3;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDR16MEMA(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R16 reg = static_cast<R16>((inst & 0b00110000) >> 4);
-    uint8_t pointer = readR16(reg);
-    uint8_t data = A();
-    mem.store8(pointer, data);
-    Log::d("LDR16MEMA: Store data " + std::to_string(data) + 
-           "(in r8A) to pointer " + std::to_string(pointer), 
-           LOG_TAG);
+    constexpr R16MEM reg = r16mem(opcode);
+    mem.store8(r16memAddress<reg>(), A());
+    cycles += 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDAR16MEM(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R16 reg = static_cast<R16>((inst & 0b00110000) >> 4);
-    uint8_t pointer = readR16(reg);
-    uint8_t data = mem.read8(pointer);
-    A(data);
-    Log::d("LDAR16MEM: Load data " + std::to_string(data) + 
-           "(at " + std::to_string(pointer) + ") to r8 " 
-           + std::to_string(r8_A), LOG_TAG);
+    constexpr R16MEM reg = r16mem(opcode);
+    A(mem.read8(r16memAddress<reg>()));
+    cycles += 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDIMM16SP(GBMEM& mem, uint16_t address) {
-    uint8_t pointer = mem.read16(address + 1);
-    mem.store8(pointer, SP & 0xFF);
-    mem.store8(pointer + 1, SP >> 8);
-    Log::d("LDIMM16SP: Stored " + std::to_string(SP) +
-           "(in SP) to pointer" + std::to_string(pointer), 
-           LOG_TAG);
+    uint16_t pointer = mem.read16(address + 1);
+    mem.store16(pointer, sp);
+    cycles += 5;
     return address + 3;
 }
 
-uint16_t GBCPU::handleINCR16(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R16 reg = static_cast<R16>((inst & 0b00110000) >> 4);
-    storeR16(reg, readR16(reg) + 1);
-    Log::d("INCR16: Incremented r16 " + std::to_string(reg), 
-           LOG_TAG);
+template<uint8_t opcode>
+uint16_t GBCPU::handleINCR16(GBMEM&, uint16_t address) {
+    constexpr R16 reg = r16(opcode);
+    storeR16<reg>(readR16<reg>() + 1);
+    cycles += 2;
     return address + 1;
 }
 
-uint16_t GBCPU::handleDECR16(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R16 reg = static_cast<R16>((inst & 0b00110000) >> 4);
-    storeR16(reg, readR16(reg) - 1);
-    Log::d("DECR16: Decremented r16 " + std::to_string(reg), 
-           LOG_TAG);
+template<uint8_t opcode>
+uint16_t GBCPU::handleDECR16(GBMEM&, uint16_t address) {
+    constexpr R16 reg = r16(opcode);
+    storeR16<reg>(readR16<reg>() - 1);
+    cycles += 2;
     return address + 1;
 }
 
-uint16_t GBCPU::handleADDHLR16(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R16 reg = static_cast<R16>((inst & 0b00110000) >> 4);
-    uint16_t hl = HL();
-    uint16_t r16 = readR16(reg);
-    bool overflow11bit = ((hl & 0x0FFF) + (r16 & 0x0FFF)) > 0x0FFF;
-    bool overflow15bit = (hl + r16) > 0xFFFF;
-    set(f_N, false);
-    set(f_H, overflow11bit);
-    set(f_C, overflow15bit);
-    Log::d("ADDHLR16: Added " + std::to_string(hl) + 
-           "(from HL) to " + std::to_string(r16) + 
-           "(from " + std::to_string(reg) + ") and "
-           " observed overflows: " + 
-           std::to_string(overflow11bit) + ", " +
-           std::to_string(overflow15bit), LOG_TAG);
+template<uint8_t opcode>
+uint16_t GBCPU::handleADDHLR16(GBMEM&, uint16_t address) {
+    constexpr R16 reg = r16(opcode);
+    uint16_t r16 = readR16<reg>();
+    uint32_t result = hl + r16;
+    lazyFlags(FlagOp::AddHL, hasZ() ? z : 0, hl, r16, result);
+    hl = result;
+    cycles += 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleINCR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>((inst & 0b00111000) >> 3);
-    uint8_t r8 = readR8(reg);
-    set(f_N, false);
+    constexpr R8 reg = r8High(opcode);
+    uint8_t r8 = readR8<reg>(mem);
     uint8_t result = r8 + 1;
-    bool overflow = ((r8 & 0b111) + 1) >> 3;
-    set(f_Z, result == 0);
-    set(f_H, overflow);
-    storeR8(reg, result);
-    Log::d("INCR8: Incremented r8 " + std::to_string(r8) +
-           "Z, H: " + std::to_string(result == 0) + ", " +
-           std::to_string(overflow), LOG_TAG);
+    lazyFlags(FlagOp::Inc, hasC() ? c : 0, r8, 1, result);
+    storeR8<reg>(mem, result);
+    cycles += reg == r8_HL ? 3 : 1;
     return address + 1;
 }
+
+template<uint8_t opcode>
 uint16_t GBCPU::handleDECR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>((inst & 0b00111000) >> 3);
-    uint8_t r8 = readR8(reg);
-    set(f_N, true);
+    constexpr R8 reg = r8High(opcode);
+    uint8_t r8 = readR8<reg>(mem);
     uint8_t result = r8 - 1;
-    bool overflow = ((r8 & 0b111) - 1) < 0;
-    set(f_Z, result == 0);
-    set(f_H, overflow);
-    storeR8(reg, result);
-    Log::d("DECR8: Decremented r8 " + std::to_string(r8) +
-           "Z, H: " + std::to_string(result == 0) + ", " +
-           std::to_string(overflow), LOG_TAG);
+    lazyFlags(FlagOp::Dec, n | (hasC() ? c : 0), r8, 1, result);
+    storeR8<reg>(mem, result);
+    cycles += reg == r8_HL ? 3 : 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDR8IMM8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>((inst & 0b00111000) >> 3);
-    uint8_t data = mem.read8(address + 1);
-    storeR8(reg, data);
-    Log::d("LDR8IMM8: Store " + std::to_string(data) +
-           " into r8 " + std::to_string(reg), LOG_TAG);
+    constexpr R8 reg = r8High(opcode);
+    storeR8<reg>(mem, mem.read8(address + 1));
+    cycles += reg == r8_HL ? 3 : 2;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRLCA(GBMEM&, uint16_t address) {
     uint8_t data = A();
     uint8_t b7 = data >> 7;
-    A((data << 1) + b7);
-    set(f_C, b7);
-    Log::d("RLCA: RLeft A from " + std::to_string(data) +
-           "to " + std::to_string(A()) + " set C to " +
-           std::to_string(hasC()), LOG_TAG);
+    A((data << 1) | b7);
+    setFlags(b7 ? c : 0);
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRRCA(GBMEM&, uint16_t address) {
     uint8_t data = A();
     uint8_t b0 = data & 0b1;
-    A((data >> 1) + (b0 << 7));
-    set(f_C, b0);
-    Log::d("RRCA: RRight A from " + std::to_string(data) +
-           "to " + std::to_string(A()) + " set C to " +
-           std::to_string(hasC()), LOG_TAG);
+    A((data >> 1) | (b0 << 7));
+    setFlags(b0 ? c : 0);
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRLA(GBMEM&, uint16_t address) {
     uint8_t data = A();
     uint8_t b7 = data >> 7;
-    A((data << 1) + hasC());
-    set(f_C, b7);
-    Log::d("RLA: RLeft A from " + std::to_string(data) +
-           "to " + std::to_string(A()) + " set C to " +
-           std::to_string(hasC()), LOG_TAG);
+    A((data << 1) | hasC());
+    setFlags(b7 ? c : 0);
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRRA(GBMEM&, uint16_t address) {
     uint8_t data = A();
     uint8_t b0 = data & 0b1;
-    A((data >> 1) + (hasC() << 7));
-    set(f_C, b0);
-    Log::d("RLA: RLeft A from " + std::to_string(data) +
-           "to " + std::to_string(A()) + " set C to " +
-           std::to_string(hasC()), LOG_TAG);
+    A((data >> 1) | (hasC() << 7));
+    setFlags(b0 ? c : 0);
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleDAA(GBMEM&, uint16_t address) {
-    uint16_t adj = 0;
+    uint8_t a = A();
+    uint8_t adj = 0;
+    bool carry = hasC();
     if (hasN()) {
-        if (hasH()) adj += 0x6;
-        if (hasC()) adj += 0x60;
-        A(A() - adj);
+        if (hasH()) adj |= 0x06;
+        if (carry) adj |= 0x60;
+        a -= adj;
     } else {
-        if (hasH() || (A() & 0xF) > 0x9) adj += 0x6;
-        if (hasC() || A() > 0x99) {
-            adj += 0x60;
-            set(f_C, true);
+        if (hasH() || (a & 0xF) > 0x9) adj |= 0x06;
+        if (carry || a > 0x99) {
+            adj |= 0x60;
+            carry = true;
         }
-        A(A() + adj);
+        a += adj;
     }
-    Log::d("DAA: A, Z, C: " + std::to_string(A()) +
-           ", " + std::to_string(hasZ()) + ", " +
-           std::to_string(hasC()), LOG_TAG);
+    A(a);
+    setFlags((a == 0 ? z : 0) | (hasN() ? n : 0) | (carry ? c : 0));
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleCPL(GBMEM&, uint16_t address) {
     A(~A());
-    set(f_N, true);
-    set(f_H, true);
-    Log::d("CPL: A after " + std::to_string(A()), LOG_TAG);
+    setFlags(flags() | n | h);
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSCFA(GBMEM&, uint16_t address) {
-    set(f_C, true);
-    Log::d("SCFA: C " + std::to_string(hasC()), LOG_TAG);
+    setFlags((flags() & z) | c);
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleCCF(GBMEM&, uint16_t address) {
-    set(f_C, !hasC());
-    Log::d("CCF: C " + std::to_string(hasC()), LOG_TAG);
+    setFlags((flags() & (z | c)) ^ c);
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleJRIMM8(GBMEM& mem, uint16_t address) {
     int8_t offset = mem.read8(address + 1);
-    uint16_t resultAdd = address + 1 + offset;
-    Log::d("JRIMM8: Jump to " + std::to_string(resultAdd), LOG_TAG);
-    return resultAdd;
+    cycles += 3;
+    return address + 2 + offset;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleJRCONDIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    int8_t offset = mem.read8(address + 1);
-    COND cond = static_cast<COND>((inst & 0b00011000) >> 3);
-    if (hasCond(cond)) {
-        uint16_t resultAdd = address + 1 + offset;
-        Log::d("JRCONDIMM8: Jump to " + 
-               std::to_string(resultAdd), LOG_TAG);
-        return resultAdd;
+    if (hasCond<cond(opcode)>()) {
+        int8_t offset = mem.read8(address + 1);
+        cycles += 3;
+        uint16_t target = address + 2 + offset;
+        // Back over a load into A and a test, so possibly a polling loop.
+        if (offset >= -7 && offset <= -4) {
+            uint8_t load = mem.read8(target);
+            if (load == 0xF0 || load == 0xF2 || load == 0xFA) skipPollLoop(mem, target, address);
+        }
+        return target;
     } else {
-        Log::d("JRCONDIMM8: Skip jump", LOG_TAG);
+        cycles += 2;
         return address + 2;
     }
 }
 
-uint16_t GBCPU::handleSTOP(GBMEM& mem, uint16_t address) {
+template<uint8_t opcode>
+uint16_t GBCPU::handleSTOP(GBMEM&, uint16_t address) {
     // TODO: FIX THIS INSTRUCTION
-    Log::d("STOP", LOG_TAG);
+    cycles += 1;
     return address + 2;
 }
 
 // ----------------------------
 //          BLOCK 1
 // ----------------------------
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDR8R8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 dest = static_cast<R8>((inst & 0b00111000) >> 3);
-    R8 source = static_cast<R8>(inst & 0b00000111);
-    storeR8(dest, readR8(source));
-    Log::d("LDR8R8: Stored " + std::to_string(readR8(source))
-           + "(from r8" + std::to_string(source) + ") to r8" 
-           + std::to_string(dest), LOG_TAG);
+    constexpr R8 dest = r8High(opcode);
+    constexpr R8 source = r8Low(opcode);
+    storeR8<dest>(mem, readR8<source>(mem));
+    cycles += (dest == r8_HL || source == r8_HL) ? 2 : 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleHALT(GBMEM& mem, uint16_t address) {
-    // TODO: Handle this instruction along with STOP
-    //       Need to handle interrupts
-    Log::d("HALT Instruction", LOG_TAG);
+    cycles += 1;
+    // With an interrupt already pending it does not halt at all. The DMG
+    // then also fails to advance PC if IME is off; that is not modelled.
+    if (!mem.pendingInterrupts()) {
+        halted = true;
+        // Ends the dispatcher; run() goes on from event to event.
+        skipTo(runUntil);
+    }
     return address + 1;
 }
 
 // ----------------------------
 //          BLOCK 2
 // ----------------------------
+template<uint8_t opcode>
 uint16_t GBCPU::handleADDAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b00000111);
-    uint8_t a = A();
-    uint8_t val = readR8(reg);
-    uint8_t result = a + val;
-    A(result);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    bool overflow3 = ((a & 0b111) + (val & 0b111)) > 0b111;
-    bool overflow7 = ((a & 0b1111111) + (val & 0b1111111)) > 0b1111111;
-    set(f_H, overflow3);
-    set(f_C, overflow7);
-    Log::d("ADDAR8: Add " + std::to_string(val) + "from (r8"
-           + std::to_string(reg) + ") to A", LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    addA(readR8<reg>(mem), 0);
+    cycles += reg == r8_HL ? 2 : 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleADCAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b00000111);
-    uint8_t a = A();
-    uint8_t val = readR8(reg);
-    uint8_t carry = hasC();
-    uint8_t result = a + val + carry;
-    A(result);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    bool overflow3 = ((a & 0b111) + (val & 0b111) + carry) > 0b111;
-    bool overflow7 = ((a & 0b1111111) + (val & 0b1111111) + carry) > 0b1111111;
-    set(f_H, overflow3);
-    set(f_C, overflow7);
-    Log::d("ADCAR8: Add " + std::to_string(val) + "from (r8"
-           + std::to_string(reg) + ") and C" + 
-           std::to_string(carry) + " to A", LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    addA(readR8<reg>(mem), hasC());
+    cycles += reg == r8_HL ? 2 : 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSUBAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b00000111);
-    uint8_t a = A();
-    uint8_t val = readR8(reg);
-    uint8_t result = a - val;
-    A(result);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    bool borrow3 = ((a & 0b111) - (val & 0b111)) < 0;
-    bool borrow7 = ((a & 0b1111111) - (val & 0b1111111)) < 0;
-    set(f_H, borrow3);
-    set(f_C, borrow7);
-    Log::d("SUBAR8: Sub " + std::to_string(val) + "from (r8"
-           + std::to_string(reg) + ") to A", LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    subA(readR8<reg>(mem), 0);
+    cycles += reg == r8_HL ? 2 : 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSBCAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b00000111);
-    uint8_t a = A();
-    uint8_t val = readR8(reg);
-    uint8_t carry = hasC();
-    uint8_t result = a - val - carry;
-    A(result);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    bool borrow3 = ((a & 0b111) - (val & 0b111) - carry) < 0;
-    bool borrow7 = ((a & 0b1111111) - (val & 0b1111111) - carry) < 0;
-    set(f_H, borrow3);
-    set(f_C, borrow7);
-    Log::d("SBCAR8: Sub " + std::to_string(val) + "from (r8"
-           + std::to_string(reg) + ") and C" + 
-           std::to_string(carry) + " to A", LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    subA(readR8<reg>(mem), hasC());
+    cycles += reg == r8_HL ? 2 : 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleANDAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b00000111);
-    uint8_t a = A();
-    uint8_t val = readR8(reg);
-    uint8_t result = a & val;
-    set(f_Z, result == 0);
-    set(f_H, true);
-    Log::d("ANDAR8: Set A to the bitwise result of and "
-           "with r8_" + std::to_string(reg), LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    andA(readR8<reg>(mem));
+    cycles += reg == r8_HL ? 2 : 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleXORAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b00000111);
-    uint8_t a = A();
-    uint8_t val = readR8(reg);
-    uint8_t result = a ^ val;
-    set(f_Z, result == 0);
-    set(f_H, true);
-    Log::d("XORAR8: Set A to the bitwise result of xor "
-           "with r8_" + std::to_string(reg), LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    xorA(readR8<reg>(mem));
+    cycles += reg == r8_HL ? 2 : 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleORAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b00000111);
-    uint8_t a = A();
-    uint8_t val = readR8(reg);
-    uint8_t result = a | val;
-    set(f_Z, result == 0);
-    set(f_H, true);
-    Log::d("ORAR8: Set A to the bitwise result of or "
-           "with r8_" + std::to_string(reg), LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    orA(readR8<reg>(mem));
+    cycles += reg == r8_HL ? 2 : 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleCPAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b00000111);
-    uint8_t a = A();
-    uint8_t val = readR8(reg);
-    set(f_Z, a - val == 0);
-    set(f_N, 1);
-    set(f_H, (a & 0xF) < (val & 0xF));
-    set(f_C, val > a);
-    Log::d("CPAR8: Compare value in A with r8_"
-           + std::to_string(reg), LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    cpA(readR8<reg>(mem));
+    cycles += reg == r8_HL ? 2 : 1;
     return address + 1;
 }
 
 // ----------------------------
 //          BLOCK 3
 // ----------------------------
+template<uint8_t opcode>
 uint16_t GBCPU::handleADDAIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t a = A();
-    uint8_t val = mem.read8(address + 1);
-    uint8_t result = a + val;
-    A(result);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    bool overflow3 = ((a & 0b111) + (val & 0b111)) > 0b111;
-    bool overflow7 = ((a & 0b1111111) + (val & 0b1111111)) > 0b1111111;
-    set(f_H, overflow3);
-    set(f_C, overflow7);
-    Log::d("ADDAIMM8: Add " + std::to_string(val) + " to A", LOG_TAG);
+    addA(mem.read8(address + 1), 0);
+    cycles += 2;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleADCAIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t a = A();
-    uint8_t val = mem.read8(address + 1);
-    uint8_t carry = hasC();
-    uint8_t result = a + val + carry;
-    A(result);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    bool overflow3 = ((a & 0b111) + (val & 0b111) + carry) > 0b111;
-    bool overflow7 = ((a & 0b1111111) + (val & 0b1111111) + carry) > 0b1111111;
-    set(f_H, overflow3);
-    set(f_C, overflow7);
-    Log::d("ADCAIMM88: Add " + std::to_string(val)
-          + " and C" + std::to_string(carry) + " to A", LOG_TAG);
+    addA(mem.read8(address + 1), hasC());
+    cycles += 2;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSUBAIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t a = A();
-    uint8_t val = mem.read8(address + 1);
-    uint8_t result = a - val;
-    A(result);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    bool borrow3 = ((a & 0b111) - (val & 0b111)) < 0;
-    bool borrow7 = ((a & 0b1111111) - (val & 0b1111111)) < 0;
-    set(f_H, borrow3);
-    set(f_C, borrow7);
-    Log::d("SUBAIMM8: Sub " + std::to_string(val) + " to A", LOG_TAG);
+    subA(mem.read8(address + 1), 0);
+    cycles += 2;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSBCAIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t a = A();
-    uint8_t val = mem.read8(address + 1);
-    uint8_t carry = hasC();
-    uint8_t result = a - val - carry;
-    A(result);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    bool borrow3 = ((a & 0b111) - (val & 0b111) - carry) < 0;
-    bool borrow7 = ((a & 0b1111111) - (val & 0b1111111) - carry) < 0;
-    set(f_H, borrow3);
-    set(f_C, borrow7);
-    Log::d("SBCAIMM8: Sub " + std::to_string(val) + " and C" + 
-           std::to_string(carry) + " to A", LOG_TAG);
+    subA(mem.read8(address + 1), hasC());
+    cycles += 2;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleANDAIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t a = A();
-    uint8_t val = mem.read8(address + 1);
-    uint8_t result = a & val;
-    set(f_Z, result == 0);
-    set(f_H, true);
-    Log::d("ANDAIMM8: Set A to the bitwise result of and "
-           "with " + std::to_string(val), LOG_TAG);
+    andA(mem.read8(address + 1));
+    cycles += 2;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleXORAIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t a = A();
-    uint8_t val = mem.read8(address + 1);
-    uint8_t result = a ^ val;
-    set(f_Z, result == 0);
-    set(f_H, true);
-    Log::d("XORAIMM8: Set A to the bitwise result of xor "
-           "with " + std::to_string(val), LOG_TAG);
+    xorA(mem.read8(address + 1));
+    cycles += 2;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleORAIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t a = A();
-    uint8_t val = mem.read8(address + 1);
-    uint8_t result = a | val;
-    set(f_Z, result == 0);
-    set(f_H, true);
-    Log::d("ORAIMM8: Set A to the bitwise result of or "
-           "with " + std::to_string(val), LOG_TAG);
+    orA(mem.read8(address + 1));
+    cycles += 2;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleCPAIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t a = A();
-    uint8_t val = mem.read8(address + 1);
-    set(f_Z, a - val == 0);
-    set(f_N, 1);
-    set(f_H, (a & 0xF) < (val & 0xF));
-    set(f_C, val > a);
-    Log::d("CPAIMM8: Compare value in A with r8_"
-           + std::to_string(val), LOG_TAG);
+    cpA(mem.read8(address + 1));
+    cycles += 2;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRETCOND(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    COND cond = static_cast<COND>((inst & 0b00011000) >> 3);
-    if (hasCond(cond)) {
-        uint8_t l8 = mem.read8(SP);
-        SP += 1;
-        uint8_t h8 = mem.read8(SP);
-        SP += 1;
-        uint16_t ret = (h8 << 8) + l8;
-        Log::d("RETCOND: Taken to " + std::to_string(ret), LOG_TAG);
-        return ret;
+    if (hasCond<cond(opcode)>()) {
+        cycles += 5;
+        return pop16(mem);
     } else {
+        cycles += 2;
         return address + 1;
     }
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRET(GBMEM& mem, uint16_t) {
-    uint16_t ret = mem.read16(SP);
-    SP += 2;
-    Log::d("RET: Return to " + std::to_string(ret), LOG_TAG);
-    return ret;
+    cycles += 4;
+    return pop16(mem);
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRETI(GBMEM& mem, uint16_t) {
-    uint16_t ret = mem.read16(SP);
-    SP += 2;
-    IME_scheduled = 2;
-    Log::d("RETI: Return to " + std::to_string(ret), LOG_TAG);
-    return ret;
+    // Unlike EI, RETI enables interrupts immediately.
+    IME = true;
+    IME_scheduled = 0;
+    cycles += 4;
+    return pop16(mem);
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleJPCONDIMM16(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    COND cond = static_cast<COND>((inst & 0b00011000) >> 3);
-    if (hasCond(cond)) {
-        uint16_t nextAdd = mem.read16(address + 1);
-        Log::d("JPCONDIMM16: Jump to " + std::to_string(nextAdd), LOG_TAG);
-        return nextAdd;
+    if (hasCond<cond(opcode)>()) {
+        cycles += 4;
+        return mem.read16(address + 1);
     } else {
-        Log::d("JPCONDIMM16: Skip jump", LOG_TAG);
+        cycles += 3;
         return address + 3;
     }
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleJPIMM16(GBMEM& mem, uint16_t address) {
-    uint16_t nextAdd = mem.read16(address + 1);
-    Log::d("JPIMM16: Jump to " + std::to_string(nextAdd), LOG_TAG);
-    return nextAdd;
+    cycles += 4;
+    return mem.read16(address + 1);
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleJPHL(GBMEM&, uint16_t) {
-    uint16_t nextAdd = HL();
-    Log::d("JPHL: Jump to " + std::to_string(nextAdd), LOG_TAG);
-    return nextAdd;
+    cycles += 1;
+    return hl;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleCALLCONDIMM16(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    COND cond = static_cast<COND>((inst & 0b00011000) >> 3);
-    if (hasCond(cond)) {
-        uint16_t nextInstAdd = address + 3;
-        SP -= 2;
-        mem.store16(SP, nextInstAdd);
-        uint16_t nextAdd = mem.read16(address + 1);
-        Log::d("CALLCONDIMM16: Calling " + std::to_string(nextAdd) +
-               " from " + std::to_string(nextInstAdd), LOG_TAG);
-        return nextAdd;
+    if (hasCond<cond(opcode)>()) {
+        push16(mem, address + 3);
+        cycles += 6;
+        return mem.read16(address + 1);
     } else {
-        Log::d("CALLCONDIMM16: Skipping call", LOG_TAG);
+        cycles += 3;
         return address + 3;
     }
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleCALLIMM16(GBMEM& mem, uint16_t address) {
-    uint16_t nextInstAdd = address + 3;
-    SP -= 2;
-    mem.store16(SP, nextInstAdd);
-    uint16_t nextAdd = mem.read16(address + 1);
-    Log::d("CALLIMM16: Calling " + std::to_string(nextAdd) +
-           " from " + std::to_string(nextInstAdd), LOG_TAG);
-    return nextAdd;
+    push16(mem, address + 3);
+    cycles += 6;
+    return mem.read16(address + 1);
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRSTTGT3(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    uint8_t vecInd = (inst & 0b00111000) >> 3;
-    uint16_t nextInstAdd = address + 1;
-    SP -= 2;
-    uint8_t nextAdd = vec[vecInd];
-    mem.store16(SP, nextInstAdd);
-    Log::d("RSTTGT3: Calling " + std::to_string(nextAdd) + 
-           " from" + std::to_string(nextInstAdd), LOG_TAG);
-    return nextAdd;
+    push16(mem, address + 1);
+    cycles += 4;
+    return tgt3(opcode);
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handlePOPR16STK(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R16 r16 = static_cast<R16>((inst & 0b00110000) >> 3);
-    uint16_t sp = mem.read16(SP);
-    storeR16(r16, sp);
-    SP += 2;
-    Log::d("POPR16STK: Popping " + std::to_string(sp) +
-           " ([SP]) into r16" + std::to_string(r16), LOG_TAG);
+    constexpr R16STK reg = r16stk(opcode);
+    storeR16STK<reg>(pop16(mem));
+    cycles += 3;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handlePUSHR16STK(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R16 r16 = static_cast<R16>((inst & 0b00110000) >> 3);
-    uint16_t data = readR16(r16);
-    SP -= 2;
-    mem.store16(SP, data);
-    Log::d("PUSHR16STK: Pushing " + std::to_string(data) +
-           " to [SP] from r16" + std::to_string(r16), LOG_TAG);
+    constexpr R16STK reg = r16stk(opcode);
+    push16(mem, readR16STK<reg>());
+    cycles += 4;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDHCA(GBMEM& mem, uint16_t address) {
-    uint8_t cVal = C();
-    uint8_t a = A();
-    mem.store8(0xFF00 + cVal, a);
-    Log::d("LDHCA: Store data " + std::to_string(a) + 
-           " from A to 0xFF00 + " + std::to_string(cVal), LOG_TAG);
+    mem.store8(0xFF00 + C(), A());
+    cycles += 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDHIMM8A(GBMEM& mem, uint16_t address) {
-    uint8_t n8 = mem.read8(address + 1);
-    uint8_t a = A();
-    mem.store8(0xFF00 + n8, a);
-    Log::d("LDHIMM8A: Store data " + std::to_string(a) + 
-           " from A to 0xFF00 + " + std::to_string(n8), LOG_TAG);
+    mem.store8(0xFF00 + mem.read8(address + 1), A());
+    cycles += 3;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDIMM16A(GBMEM& mem, uint16_t address) {
-    uint8_t n16 = mem.read16(address + 1);
-    uint8_t a = A();
-    mem.store8(n16, a);
-    Log::d("LDIMM16A: Store data " + std::to_string(a) + 
-           " from A to + " + std::to_string(n16), LOG_TAG);
+    mem.store8(mem.read16(address + 1), A());
+    cycles += 4;
     return address + 3;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDHAC(GBMEM& mem, uint16_t address) {
-    uint8_t cVal = C();
-    uint8_t data = mem.read8(0xFF00 + cVal);
-    A(data);
-    Log::d("LDHAC: Load data " + std::to_string(data) + 
-           " to A from 0xFF00 + " + std::to_string(cVal), LOG_TAG);
+    A(mem.read8(0xFF00 + C()));
+    cycles += 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDHAIMM8(GBMEM& mem, uint16_t address) {
-    uint8_t n8 = mem.read8(address + 1);
-    uint8_t data = mem.read8(0xFF00 + n8);
-    A(data);
-    Log::d("LDHAIMM8: Load data " + std::to_string(data) + 
-           " to A from 0xFF00 + " + std::to_string(n8), LOG_TAG);
+    A(mem.read8(0xFF00 + mem.read8(address + 1)));
+    cycles += 3;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDAIMM16(GBMEM& mem, uint16_t address) {
-    uint8_t n16 = mem.read16(address + 1);
-    uint8_t data = mem.read8(n16);
-    A(data);
-    Log::d("LDAIMM16: Load data " + std::to_string(data) + 
-           " to A from 0xFF00 + " + std::to_string(n16), LOG_TAG);
+    A(mem.read8(mem.read16(address + 1)));
+    cycles += 4;
     return address + 3;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleADDSPIMM8(GBMEM& mem, uint16_t address) {
-    int8_t e8 = static_cast<int8_t>(mem.read8(address + 1));
-    SP += e8;
-    set(f_Z, 0);
-    set(f_N, 0);
-    set(f_H, (SP & 0b111) + (e8 & 0b111) > 0b111);
-    set(f_H, (SP & 0b1111111) + (e8 & 0b1111111) > 0b1111111);
-    Log::d("ADDSPIMM8: Add " + std::to_string(e8) + " to SP", LOG_TAG);
+    uint8_t u8 = mem.read8(address + 1);
+    setFlags((((sp & 0xF) + (u8 & 0xF)) > 0xF ? h : 0) | (((sp & 0xFF) + u8) > 0xFF ? c : 0));
+    sp += static_cast<int8_t>(u8);
+    cycles += 4;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDHLSPIMM8(GBMEM& mem, uint16_t address) {
-    int8_t e8 = static_cast<int8_t>(mem.read8(address + 1));
-    SP += e8;
-    set(f_Z, 0);
-    set(f_N, 0);
-    set(f_H, (SP & 0b111) + (e8 & 0b111) > 0b111);
-    set(f_H, (SP & 0b1111111) + (e8 & 0b1111111) > 0b1111111);
-    HL(SP);
-    Log::d("LDHLSPIMM8: Add " + std::to_string(e8) + " to SP", LOG_TAG);
+    uint8_t u8 = mem.read8(address + 1);
+    setFlags((((sp & 0xF) + (u8 & 0xF)) > 0xF ? h : 0) | (((sp & 0xFF) + u8) > 0xFF ? c : 0));
+    hl = sp + static_cast<int8_t>(u8);
+    cycles += 3;
     return address + 2;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleLDSPHL(GBMEM&, uint16_t address) {
-    SP = HL();
-    Log::d("LDSPHL: Load " + std::to_string(HL()) 
-           + "into SP", LOG_TAG);
+    sp = hl;
+    cycles += 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleDI(GBMEM&, uint16_t address) {
     IME = false;
     IME_scheduled = 0;
-    Log::d("DI: Clear IME flag", LOG_TAG);
+    cycles += 1;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleEI(GBMEM&, uint16_t address) {
+    // Interrupts come on after the next instruction, which run() steps on
+    // its own; ending the dispatcher here hands it back.
     IME_scheduled = 1;
-    Log::d("EI: Set IME flag after next inst", LOG_TAG);
+    cycles += 1;
+    runUntil = cycles;
     return address + 1;
 }
 
 // ----------------------------
 //          BLOCK 4
 // ----------------------------
+template<uint8_t opcode>
 uint16_t GBCPU::handleCB(GBMEM& mem, uint16_t address) {
     uint8_t inst = mem.read8(address + 1);
-    if ((inst & RLCR8)   == RLCR8)   return handleRLCR8(mem, address + 1);
-    if ((inst & RRCR8)   == RRCR8)   return handleRRCR8(mem, address + 1);
-    if ((inst & RLR8)    == RLR8)    return handleRLR8(mem, address + 1);
-    if ((inst & RRR8)    == RRR8)    return handleRRR8(mem, address + 1);
-    if ((inst & SLAR8)   == SLAR8)   return handleSLAR8(mem, address + 1);
-    if ((inst & SRAR8)   == SRAR8)   return handleSRAR8(mem, address + 1);
-    if ((inst & SWAPR8)  == SWAPR8)  return handleSWAPR8(mem, address + 1);
-    if ((inst & SRLR8)   == SRLR8)   return handleSRLR8(mem, address + 1);
-    if ((inst & BITB3R8) == BITB3R8) return handleBITB3R8(mem, address + 1);
-    if ((inst & RESB3R8) == RESB3R8) return handleRESB3R8(mem, address + 1);
-    if ((inst & SETB3R8) == SETB3R8) return handleSETB3R8(mem, address + 1);
-    Log::d("CB: Invalid Instruction format", LOG_TAG);
-    return address + 1;
+    return (this->*cbDecodeTable[inst])(mem, address + 1);
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRLCR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
+    constexpr R8 reg = r8Low(opcode);
+    uint8_t r8 = readR8<reg>(mem);
     uint8_t b7 = r8 >> 7;
-    uint8_t result = (r8 << 1) + b7;
-    set(f_Z, result == 0);
-    set(f_N, false);
-    set(f_H, false);
-    set(f_C, b7);
-    storeR8(reg, result);
-    Log::d("RLCR8: Rotate left " + std::to_string(r8) +
-           " in r8_" + std::to_string(reg), LOG_TAG);
+    uint8_t result = (r8 << 1) | b7;
+    setFlags((result == 0 ? z : 0) | (b7 ? c : 0));
+    storeR8<reg>(mem, result);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRRCR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
+    constexpr R8 reg = r8Low(opcode);
+    uint8_t r8 = readR8<reg>(mem);
     uint8_t b0 = r8 & 0b1;
-    uint8_t result = (r8 >> 1) + (b0 << 7);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    set(f_H, false);
-    set(f_C, b0);
-    storeR8(reg, result);
-    Log::d("RRCR8: Rotate right " + std::to_string(r8) +
-           " in r8_" + std::to_string(reg), LOG_TAG);
+    uint8_t result = (r8 >> 1) | (b0 << 7);
+    setFlags((result == 0 ? z : 0) | (b0 ? c : 0));
+    storeR8<reg>(mem, result);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
+
+template<uint8_t opcode>
 uint16_t GBCPU::handleRLR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
+    constexpr R8 reg = r8Low(opcode);
+    uint8_t r8 = readR8<reg>(mem);
     uint8_t b7 = r8 >> 7;
-    uint8_t result = (r8 << 1) + hasC();
-    set(f_Z, result == 0);
-    set(f_N, false);
-    set(f_H, false);
-    set(f_C, b7);
-    storeR8(reg, result);
-    Log::d("RLR8: Rotate left " + std::to_string(r8) +
-           " in r8_" + std::to_string(reg), LOG_TAG);
+    uint8_t result = (r8 << 1) | hasC();
+    setFlags((result == 0 ? z : 0) | (b7 ? c : 0));
+    storeR8<reg>(mem, result);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
+
+template<uint8_t opcode>
 uint16_t GBCPU::handleRRR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
+    constexpr R8 reg = r8Low(opcode);
+    uint8_t r8 = readR8<reg>(mem);
     uint8_t b0 = r8 & 0b1;
-    uint8_t result = (r8 >> 1) + (hasC() << 7);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    set(f_H, false);
-    set(f_C, b0);
-    storeR8(reg, result);
-    Log::d("RRR8: Rotate right " + std::to_string(r8) +
-           " in r8_" + std::to_string(reg), LOG_TAG);
+    uint8_t result = (r8 >> 1) | (hasC() << 7);
+    setFlags((result == 0 ? z : 0) | (b0 ? c : 0));
+    storeR8<reg>(mem, result);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSLAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
+    constexpr R8 reg = r8Low(opcode);
+    uint8_t r8 = readR8<reg>(mem);
     uint8_t b7 = r8 >> 7;
-    uint8_t result = (r8 << 1);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    set(f_H, false);
-    set(f_C, b7);
-    storeR8(reg, result);
-    Log::d("SLAR8: Rotate left " + std::to_string(r8) +
-           " in r8_" + std::to_string(reg), LOG_TAG);
+    uint8_t result = r8 << 1;
+    setFlags((result == 0 ? z : 0) | (b7 ? c : 0));
+    storeR8<reg>(mem, result);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSRAR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
+    constexpr R8 reg = r8Low(opcode);
+    uint8_t r8 = readR8<reg>(mem);
     uint8_t b0 = r8 & 0b1;
     uint8_t b7 = r8 & 0b10000000;
-    uint8_t result = (r8 >> 1) + b7;
-    set(f_Z, result == 0);
-    set(f_N, false);
-    set(f_H, false);
-    set(f_C, b0);
-    storeR8(reg, result);
-    Log::d("SRAR8: Rotate right " + std::to_string(r8) +
-           " in r8_" + std::to_string(reg), LOG_TAG);
+    uint8_t result = (r8 >> 1) | b7;
+    setFlags((result == 0 ? z : 0) | (b0 ? c : 0));
+    storeR8<reg>(mem, result);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSWAPR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
-    storeR8(reg, ((r8 & 0xF) << 4) + ((r8 & 0xF0) >> 4));
-    set(f_Z, r8 == 0);
-    set(f_N, 0);
-    set(f_H, 0);
-    set(f_C, 0);
-    Log::d("SWAPR8: Swap bits of r8_" + std::to_string(reg), LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    uint8_t r8 = readR8<reg>(mem);
+    storeR8<reg>(mem, ((r8 & 0xF) << 4) | ((r8 & 0xF0) >> 4));
+    setFlags(r8 == 0 ? z : 0);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSRLR8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
+    constexpr R8 reg = r8Low(opcode);
+    uint8_t r8 = readR8<reg>(mem);
     uint8_t b0 = r8 & 0b1;
-    uint8_t result = (r8 >> 1);
-    set(f_Z, result == 0);
-    set(f_N, false);
-    set(f_H, false);
-    set(f_C, b0);
-    storeR8(reg, result);
-    Log::d("SRLR8: Rotate right " + std::to_string(r8) +
-           " in r8_" + std::to_string(reg), LOG_TAG);
+    uint8_t result = r8 >> 1;
+    setFlags((result == 0 ? z : 0) | (b0 ? c : 0));
+    storeR8<reg>(mem, result);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleBITB3R8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    uint8_t bitNum = (inst & 0b00111000) >> 3;
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
-    set(f_Z, !(r8 & (1 << bitNum)));
-    set(f_N, 0);
-    set(f_H, 1);
-    Log::d("BITB3R8: Check bit num " + std::to_string(bitNum) +
-           " of r8_" + std::to_string(reg), LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    constexpr uint8_t mask = 1 << b3(opcode);
+    uint8_t r8 = readR8<reg>(mem);
+    setFlags((r8 & mask ? 0 : z) | h | (hasC() ? c : 0));
+    // BIT only reads [HL], so it is one access cheaper than the others.
+    cycles += reg == r8_HL ? 3 : 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleRESB3R8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    uint8_t bitNum = (inst & 0b00111000) >> 3;
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
-    uint8_t mask = 1 << bitNum;
-    storeR8(reg, r8 & (~mask));
-    Log::d("RESB3R8: Reset bit num " + std::to_string(bitNum) +
-           " of r8_" + std::to_string(reg), LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    constexpr uint8_t mask = 1 << b3(opcode);
+    storeR8<reg>(mem, readR8<reg>(mem) & ~mask);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
 
+template<uint8_t opcode>
 uint16_t GBCPU::handleSETB3R8(GBMEM& mem, uint16_t address) {
-    uint8_t inst = mem.read8(address);
-    uint8_t bitNum = (inst & 0b00111000) >> 3;
-    R8 reg = static_cast<R8>(inst & 0b111);
-    uint8_t r8 = readR8(reg);
-    uint8_t mask = 1 << bitNum;
-    storeR8(reg, r8 | mask);
-    Log::d("SETB3R8: Set bit num " + std::to_string(bitNum) +
-           " of r8_" + std::to_string(reg), LOG_TAG);
+    constexpr R8 reg = r8Low(opcode);
+    constexpr uint8_t mask = 1 << b3(opcode);
+    storeR8<reg>(mem, readR8<reg>(mem) | mask);
+    cycles += reg == r8_HL ? 4 : 2;
     return address + 1;
 }
@@ -0,0 +1,459 @@
+#include <cpu/Dynarec.h>
+#include <cpu/GBCpu.h>
+#include <utils/log.h>
+#include <array>
+#include <cstring>
+#include <initializer_list>
+
+#if GB_DYNAREC_X64
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+constexpr const char *LOG_TAG = "DYNAREC";
+
+// Full memory comparison in lockstep mode, every this many checks.
+static constexpr uint64_t LOCKSTEP_MEMORY_INTERVAL = 256;
+
+namespace {
+
+// Raw x86-64 encoder for the few instructions the translator emits. In
+// generated code rbx holds the GBCPU*, r12 the GBMEM* and r13d the code
+// write count at block entry. Operands in the CPU are addressed as
+// [rbx + disp32].
+class Emitter {
+    public:
+        Emitter(uint8_t *at, uint8_t *limit): at(at), limit(limit) {}
+
+        uint8_t *pos() const { return at; }
+        bool overflow() const { return failed; }
+
+        // push rbx, r12, r13, which leaves rsp 16 byte aligned; load the
+        // arguments.
+        void prologue() {
+            bytes({0x53, 0x41, 0x54, 0x41, 0x55, 0x48, 0x89, 0xFB, 0x49, 0x89, 0xF4});
+        }
+
+        void epilogue() {
+            bytes({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3});
+        }
+
+        // mov r13d, [r12 + offset]
+        void loadCodeWrites(int32_t offset) { bytes({0x45, 0x8B, 0xAC, 0x24}); imm32(offset); }
+
+        // mov ecx, [r12 + offset]; cmp ecx, r13d
+        void compareCodeWrites(int32_t offset) {
+            bytes({0x41, 0x8B, 0x8C, 0x24});
+            imm32(offset);
+            bytes({0x44, 0x39, 0xE9});
+        }
+
+        // add qword [rbx + offset], value
+        void addQword(int32_t offset, uint32_t value) { bytes({0x48, 0x81, 0x83}); imm32(offset); imm32(value); }
+
+        // fn(rbx, r12, address), result in ax.
+        void callThunk(uint16_t address, const void *fn) {
+            bytes({0x48, 0x89, 0xDF, 0x4C, 0x89, 0xE6, 0xBA});
+            imm32(address);
+            bytes({0x48, 0xB8});
+            imm64(reinterpret_cast<uintptr_t>(fn));
+            bytes({0xFF, 0xD0});
+        }
+
+        // mov cl, [rbx + source]; mov [rbx + dest], cl
+        void moveByte(int32_t dest, int32_t source) {
+            bytes({0x8A, 0x8B});
+            imm32(source);
+            bytes({0x88, 0x8B});
+            imm32(dest);
+        }
+
+        void storeByte(int32_t dest, uint8_t value) { bytes({0xC6, 0x83}); imm32(dest); byte(value); }
+        void storeWord(int32_t dest, uint16_t value) { bytes({0x66, 0xC7, 0x83}); imm32(dest); imm16(value); }
+        void incWord(int32_t dest) { bytes({0x66, 0xFF, 0x83}); imm32(dest); }
+        void decWord(int32_t dest) { bytes({0x66, 0xFF, 0x8B}); imm32(dest); }
+        void movEax(uint32_t value) { byte(0xB8); imm32(value); }
+
+        static constexpr uint8_t JE = 0x84, JNE = 0x85, JAE = 0x83;
+
+        // Conditional rel32 jump; returns the field for patch().
+        uint8_t *jcc(uint8_t condition) {
+            bytes({0x0F, condition});
+            uint8_t *field = at;
+            imm32(0);
+            return field;
+        }
+
+        void patch(uint8_t *field, const uint8_t *target) {
+            if (failed) return;
+            int32_t rel = int32_t(target - (field + 4));
+            std::memcpy(field, &rel, sizeof(rel));
+        }
+
+        // Jumps to *slot if ax == target (skipped when the exit is
+        // unconditional), the slot is filled and the CPU's cycle count is
+        // still below its runUntil.
+        void link(uint16_t target, bool compare, const uint8_t **slot, int32_t cyclesOffset,
+                  int32_t runUntilOffset) {
+            uint8_t *skips[3] = {nullptr, nullptr, nullptr};
+            if (compare) {
+                bytes({0x66, 0x3D});
+                imm16(target);
+                skips[0] = jcc(JNE);
+            }
+            // mov rcx, slot; mov rcx, [rcx]; test rcx, rcx
+            bytes({0x48, 0xB9});
+            imm64(reinterpret_cast<uintptr_t>(slot));
+            bytes({0x48, 0x8B, 0x09, 0x48, 0x85, 0xC9});
+            skips[1] = jcc(JE);
+            // mov r8, [rbx + cycles]; cmp r8, [rbx + runUntil]
+            bytes({0x4C, 0x8B, 0x83});
+            imm32(cyclesOffset);
+            bytes({0x4C, 0x3B, 0x83});
+            imm32(runUntilOffset);
+            skips[2] = jcc(JAE);
+            // jmp rcx
+            bytes({0xFF, 0xE1});
+            for (uint8_t *skip: skips) {
+                if (skip) patch(skip, at);
+            }
+        }
+
+    private:
+        void byte(uint8_t value) {
+            if (at < limit) *at++ = value;
+            else failed = true;
+        }
+        void bytes(std::initializer_list<uint8_t> values) { for (uint8_t value: values) byte(value); }
+        void imm16(uint16_t value) { byte(value); byte(value >> 8); }
+        void imm32(uint32_t value) { for (int i = 0; i < 4; ++i) byte(value >> (8 * i)); }
+        void imm64(uint64_t value) { for (int i = 0; i < 8; ++i) byte(value >> (8 * i)); }
+
+        uint8_t *at;
+        uint8_t *limit;
+        bool failed = false;
+};
+
+}
+
+struct Dynarec::Shadow {
+    GBCPU cpu;
+    GBMEM mem;
+    uint16_t address = 0;
+
+    void copy(const GBCPU &from, const GBMEM &fromMem, uint16_t at) {
+        cpu.AF(from.AF());
+        cpu.bc = from.bc;
+        cpu.de = from.de;
+        cpu.hl = from.hl;
+        cpu.sp = from.sp;
+        cpu.IME = from.IME;
+        cpu.IME_scheduled = from.IME_scheduled;
+        cpu.halted = from.halted;
+        cpu.cycles = from.cycles;
+        cpu.instructions = from.instructions;
+        mem = fromMem;
+        mem.setClock(&cpu.cycles);
+        address = at;
+    }
+};
+
+Dynarec::Dynarec() = default;
+
+Dynarec::~Dynarec() {
+#if GB_DYNAREC_X64
+    if (code) munmap(code, CODE_CACHE_SIZE);
+#endif
+}
+
+bool Dynarec::allocate() {
+#if GB_DYNAREC_X64
+    void *mapping = mmap(nullptr, CODE_CACHE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED) {
+        LOG_E(LOG_TAG, "Cannot map a %zu byte code cache, staying in the interpreter", CODE_CACHE_SIZE);
+        unavailable = true;
+        return false;
+    }
+    code = cursor = static_cast<uint8_t*>(mapping);
+    return true;
+#else
+    unavailable = true;
+    return false;
+#endif
+}
+
+// The cache is never writable and executable at once: a translation opens
+// the pages from the cursor on for writing and seals them again after.
+bool Dynarec::protect(uint8_t *from, bool writable) {
+#if GB_DYNAREC_X64
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    uint8_t *begin = code + size_t(from - code) / page * page;
+    int access = writable ? PROT_READ | PROT_WRITE : PROT_READ | PROT_EXEC;
+    if (mprotect(begin, size_t(code + CODE_CACHE_SIZE - begin), access) == 0) return true;
+    LOG_E(LOG_TAG, "Cannot make the code cache %s, staying in the interpreter",
+          writable ? "writable" : "executable");
+#else
+    (void)from;
+    (void)writable;
+#endif
+    unavailable = true;
+    return false;
+}
+
+const uint8_t *Dynarec::resolve(BlockCache &cache, uint16_t bank, uint16_t target) {
+    Block *block = cache.get(bank, target);
+    return block ? block->nativeBody : nullptr;
+}
+
+bool Dynarec::translate(const GBCPU &cpu, const GBMEM &mem, BlockCache &cache, Block &block) {
+    if (unavailable || full) return false;
+    if (!code && !allocate()) return false;
+
+    auto cpuOffset = [&](const void *field) {
+        return int32_t(static_cast<const char*>(field) - reinterpret_cast<const char*>(&cpu));
+    };
+    const int32_t AF = cpuOffset(&cpu.af), BC = cpuOffset(&cpu.bc), DE = cpuOffset(&cpu.de);
+    const int32_t HL = cpuOffset(&cpu.hl), SP = cpuOffset(&cpu.sp);
+    const int32_t CYCLES = cpuOffset(&cpu.cycles), INSTRUCTIONS = cpuOffset(&cpu.instructions);
+    const int32_t RUN_UNTIL = cpuOffset(&cpu.runUntil);
+    const int32_t CODE_WRITES = int32_t(reinterpret_cast<const char*>(mem.codeWriteCounter()) -
+                                        reinterpret_cast<const char*>(&mem));
+    // Register pairs are little endian, so the high register is at +1.
+    const std::array<int32_t, 8> r8 = {BC + 1, BC, DE + 1, DE, HL + 1, HL, -1, AF + 1};
+    const std::array<int32_t, 4> r16 = {BC, DE, HL, SP};
+
+    auto mayStore = [&](GBCPU::Inst inst, uint8_t opcode, uint8_t cb) {
+        switch (inst) {
+            case GBCPU::LDR16MEMA: case GBCPU::LDIMM16SP: case GBCPU::CALLCONDIMM16:
+            case GBCPU::CALLIMM16: case GBCPU::RSTTGT3: case GBCPU::PUSHR16STK:
+            case GBCPU::LDHCA: case GBCPU::LDHIMM8A: case GBCPU::LDIMM16A:
+                return true;
+            case GBCPU::INCR8: case GBCPU::DECR8: case GBCPU::LDR8IMM8: case GBCPU::LDR8R8:
+                return GBCPU::r8High(opcode) == GBCPU::r8_HL;
+            case GBCPU::CB:
+                return GBCPU::r8Low(cb) == GBCPU::r8_HL &&
+                       GBCPU::decode(GBCPU::cbInstructionList, cb) != GBCPU::BITB3R8;
+            default:
+                return false;
+        }
+    };
+    auto touchesIO = [&](GBCPU::Inst inst, uint16_t address) {
+        switch (inst) {
+            case GBCPU::LDHCA: case GBCPU::LDHIMM8A: case GBCPU::LDHAC: case GBCPU::LDHAIMM8:
+                return true;
+            case GBCPU::LDIMM16A: case GBCPU::LDAIMM16:
+                return mem.read16(address + 1) >= 0xFF00;
+            default:
+                return false;
+        }
+    };
+
+    // RAM can be rewritten under the translation and I/O accesses will
+    // need exact timing, so both stay with the block interpreter. So does
+    // HALT, which skips time the lockstep shadow does not.
+    bool stores = false;
+    bool interpret = block.start >= 0x8000;
+    for (const Block::Entry &entry: block.entries) {
+        GBCPU::Inst inst = GBCPU::decode(GBCPU::instructionList, entry.opcode);
+        uint8_t cb = inst == GBCPU::CB ? mem.read8(entry.address) : 0;
+        if (touchesIO(inst, entry.address) || inst == GBCPU::HALT) interpret = true;
+        if (mayStore(inst, entry.opcode, cb)) stores = true;
+    }
+    if (interpret) {
+        block.interpretOnly = true;
+        ++rejectedBlocks;
+        return false;
+    }
+
+    uint8_t *start = cursor;
+    if (!protect(start, true)) return false;
+    Emitter e(cursor, code + CODE_CACHE_SIZE);
+    uint8_t *entryPoint = e.pos();
+    e.prologue();
+    uint8_t *body = e.pos();
+    e.loadCodeWrites(CODE_WRITES);
+
+    uint32_t pendingCycles = 0, pendingInstructions = 0;
+    auto flushCounters = [&]() {
+        if (pendingCycles) e.addQword(CYCLES, pendingCycles);
+        if (pendingInstructions) e.addQword(INSTRUCTIONS, pendingInstructions);
+        pendingCycles = pendingInstructions = 0;
+    };
+
+    std::vector<uint8_t*> exits;
+    bool constantExit = false;   // eax holds the one possible next PC
+    bool eaxLive = false;        // eax holds the next PC
+    GBCPU::Inst lastInst = GBCPU::INVALID;
+    for (size_t i = 0; i < block.entries.size(); ++i) {
+        const Block::Entry &entry = block.entries[i];
+        bool last = i + 1 == block.entries.size();
+        uint8_t opcode = entry.opcode;
+        GBCPU::Inst inst = GBCPU::decode(GBCPU::instructionList, opcode);
+        lastInst = inst;
+        ++pendingInstructions;
+        eaxLive = false;
+
+        // Inline forms, charged the same cycles as their handlers.
+        GBCPU::R8 dest = GBCPU::r8High(opcode), source = GBCPU::r8Low(opcode);
+        if (inst == GBCPU::NOP) {
+            pendingCycles += 1;
+        } else if (inst == GBCPU::LDR8R8 && dest != GBCPU::r8_HL && source != GBCPU::r8_HL) {
+            if (dest != source) e.moveByte(r8[dest], r8[source]);
+            pendingCycles += 1;
+        } else if (inst == GBCPU::LDR8IMM8 && dest != GBCPU::r8_HL) {
+            e.storeByte(r8[dest], mem.read8(entry.address + 1));
+            pendingCycles += 2;
+        } else if (inst == GBCPU::LDR16IMM16) {
+            e.storeWord(r16[GBCPU::r16(opcode)], mem.read16(entry.address + 1));
+            pendingCycles += 3;
+        } else if (inst == GBCPU::INCR16) {
+            e.incWord(r16[GBCPU::r16(opcode)]);
+            pendingCycles += 2;
+        } else if (inst == GBCPU::DECR16) {
+            e.decWord(r16[GBCPU::r16(opcode)]);
+            pendingCycles += 2;
+        } else if (inst == GBCPU::JPIMM16) {
+            e.movEax(mem.read16(entry.address + 1));
+            pendingCycles += 4;
+            constantExit = eaxLive = true;
+        } else if (inst == GBCPU::JRIMM8) {
+            e.movEax(uint16_t(entry.next + int8_t(mem.read8(entry.address + 1))));
+            pendingCycles += 3;
+            constantExit = eaxLive = true;
+        } else {
+            uint8_t cb = opcode == 0xCB ? mem.read8(entry.address) : 0;
+            // The handler may look at the counters, so they are exact
+            // before every call.
+            flushCounters();
+            e.callThunk(entry.address, reinterpret_cast<const void*>(GBCPU::thunkFor(opcode, cb)));
+            eaxLive = true;
+            // A store into cached code ends the block like in runBlock.
+            if (!last && mayStore(inst, opcode, cb)) {
+                e.compareCodeWrites(CODE_WRITES);
+                exits.push_back(e.jcc(Emitter::JNE));
+            }
+        }
+    }
+    if (!eaxLive) e.movEax(block.end);
+    flushCounters();
+
+    // Static successors worth linking. Blocks ending in DI/EI/RETI/HALT/
+    // STOP always go back to the dispatcher for the interrupt check.
+    const Block::Entry &tail = block.entries.back();
+    uint16_t next = tail.next;
+    uint16_t immediate16 = mem.read16(tail.address + 1);
+    uint16_t relative = uint16_t(next + int8_t(mem.read8(tail.address + 1)));
+    std::vector<uint16_t> targets;
+    switch (lastInst) {
+        case GBCPU::JPIMM16: case GBCPU::CALLIMM16: targets = {immediate16}; break;
+        case GBCPU::JRIMM8: targets = {relative}; break;
+        case GBCPU::JPCONDIMM16: case GBCPU::CALLCONDIMM16: targets = {immediate16, next}; break;
+        case GBCPU::JRCONDIMM8: targets = {relative, next}; break;
+        case GBCPU::RSTTGT3: targets = {GBCPU::tgt3(tail.opcode)}; break;
+        default:
+            if (!GBCPU::endsBlock(lastInst)) targets = {next};
+            break;
+    }
+    // Lockstep compares after every block, so nothing is linked.
+    if (lockstep) targets.clear();
+    bool compare = !(targets.size() == 1 && (constantExit || lastInst == GBCPU::CALLIMM16 ||
+                                             lastInst == GBCPU::RSTTGT3 || !GBCPU::endsBlock(lastInst)));
+    for (uint16_t target: targets) {
+        // A bank switch can only come from a store, so same region targets
+        // keep this block's bank unless the block stores. Links into
+        // 0000-3FFF follow its current bank through sync().
+        if (target >= 0x8000) continue;
+        bool sameRegion = !((target ^ block.start) & 0xC000);
+        if (target >= 0x4000 && (!sameRegion || stores)) continue;
+        uint16_t bank = target < 0x4000 ? mem.bankOf(target) : block.bank;
+        const uint8_t **slot = &linkSlots.emplace_back(resolve(cache, bank, target));
+        linkList.push_back({bank, target, slot});
+        e.link(target, compare, slot, CYCLES, RUN_UNTIL);
+    }
+
+    for (uint8_t *exit: exits) e.patch(exit, e.pos());
+    e.epilogue();
+    if (!protect(start, false)) return false;
+    if (e.overflow()) {
+        LOG_I(LOG_TAG, "Code cache full after %zu blocks, flushing", translatedBlocks);
+        full = true;
+        return false;
+    }
+
+    cursor = e.pos();
+    block.native = reinterpret_cast<Block::Native>(entryPoint);
+    block.nativeBody = body;
+    ++translatedBlocks;
+    // Links waiting for this block, including its own back edge.
+    for (Link &link: linkList) {
+        if (link.target == block.start && link.bank == block.bank) *link.slot = body;
+    }
+    return true;
+}
+
+void Dynarec::flush() {
+    cursor = code;
+    full = false;
+    linkSlots.clear();
+    linkList.clear();
+    ++flushCount;
+}
+
+void Dynarec::sync(BlockCache &cache, const GBMEM &mem) {
+    bool rebanked = mem.fixedBankGeneration() != syncedBankGeneration;
+    if (!rebanked && cache.nativeInvalidations() == syncedInvalidations) return;
+    syncedInvalidations = cache.nativeInvalidations();
+    syncedBankGeneration = mem.fixedBankGeneration();
+    for (Link &link: linkList) {
+        if (rebanked && link.target < 0x4000) link.bank = mem.bankOf(link.target);
+        *link.slot = resolve(cache, link.bank, link.target);
+    }
+}
+
+void Dynarec::setLockstep(bool enable) {
+    lockstep = enable;
+    if (!enable) shadow.reset();
+}
+
+void Dynarec::endLockstep() {
+    shadow.reset();
+}
+
+void Dynarec::beginLockstep(const GBCPU &cpu, const GBMEM &mem) {
+    shadow = std::make_unique<Shadow>();
+    shadow->copy(cpu, mem, cpu.pc);
+}
+
+bool Dynarec::checkLockstep(const GBCPU &cpu, const GBMEM &mem, uint16_t address) {
+    Shadow &s = *shadow;
+    while (s.cpu.instructions < cpu.instructions) {
+        s.address = s.cpu.parseInstruction(s.mem, s.address);
+    }
+    ++checks;
+
+    const GBCPU &ref = s.cpu;
+    bool same = s.address == address && ref.AF() == cpu.AF() && ref.bc == cpu.bc && ref.de == cpu.de &&
+                ref.hl == cpu.hl && ref.sp == cpu.sp && ref.cycles == cpu.cycles;
+    if (!same) {
+        LOG_E(LOG_TAG, "Lockstep mismatch after %llu instructions: "
+              "native PC=%04X AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X cycles=%llu, "
+              "interpreter PC=%04X AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X cycles=%llu",
+              (unsigned long long)cpu.instructions,
+              address, cpu.AF(), cpu.bc, cpu.de, cpu.hl, cpu.sp, (unsigned long long)cpu.cycles,
+              s.address, ref.AF(), ref.bc, ref.de, ref.hl, ref.sp, (unsigned long long)ref.cycles);
+    } else if (checks % LOCKSTEP_MEMORY_INTERVAL == 0) {
+        for (uint32_t at = 0; at < 0x10000; ++at) {
+            if (mem.read8(at) == s.mem.read8(at)) continue;
+            LOG_E(LOG_TAG, "Lockstep memory mismatch at %04X: native %02X, interpreter %02X",
+                  at, mem.read8(at), s.mem.read8(at));
+            same = false;
+            break;
+        }
+    }
+    if (same) return true;
+
+    // Resynchronize so one divergence is reported once.
+    ++mismatches;
+    s.copy(cpu, mem, address);
+    return false;
+}
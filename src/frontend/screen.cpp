@@ -0,0 +1,280 @@
+#include <frontend/Screen.h>
+#include <SDL3/SDL.h>
+#include <SDL3/SDL_opengl.h>
+#include <algorithm>
+#include <cstring>
+
+// Weight of the newest frame in the running averages.
+static constexpr double SMOOTHING = 1.0 / 32;
+
+static void average(double &mean, double sample) {
+    mean = mean ? mean + (sample - mean) * SMOOTHING : sample;
+}
+
+static double microsSince(Uint64 start) {
+    return double(SDL_GetPerformanceCounter() - start) * 1e6 / double(SDL_GetPerformanceFrequency());
+}
+
+// Entry points past GL 1.1, which are not exported everywhere.
+#define SCREEN_GL_FUNCTIONS(X)                                          \
+    X(PFNGLGENBUFFERSPROC, GenBuffers)                                  \
+    X(PFNGLDELETEBUFFERSPROC, DeleteBuffers)                            \
+    X(PFNGLBINDBUFFERPROC, BindBuffer)                                  \
+    X(PFNGLBUFFERDATAPROC, BufferData)                                  \
+    X(PFNGLMAPBUFFERRANGEPROC, MapBufferRange)                          \
+    X(PFNGLUNMAPBUFFERPROC, UnmapBuffer)                                \
+    X(PFNGLGENVERTEXARRAYSPROC, GenVertexArrays)                        \
+    X(PFNGLDELETEVERTEXARRAYSPROC, DeleteVertexArrays)                  \
+    X(PFNGLBINDVERTEXARRAYPROC, BindVertexArray)                        \
+    X(PFNGLCREATESHADERPROC, CreateShader)                              \
+    X(PFNGLSHADERSOURCEPROC, ShaderSource)                              \
+    X(PFNGLCOMPILESHADERPROC, CompileShader)                            \
+    X(PFNGLGETSHADERIVPROC, GetShaderiv)                                \
+    X(PFNGLGETSHADERINFOLOGPROC, GetShaderInfoLog)                      \
+    X(PFNGLDELETESHADERPROC, DeleteShader)                              \
+    X(PFNGLCREATEPROGRAMPROC, CreateProgram)                            \
+    X(PFNGLATTACHSHADERPROC, AttachShader)                              \
+    X(PFNGLLINKPROGRAMPROC, LinkProgram)                                \
+    X(PFNGLGETPROGRAMIVPROC, GetProgramiv)                              \
+    X(PFNGLGETPROGRAMINFOLOGPROC, GetProgramInfoLog)                    \
+    X(PFNGLDELETEPROGRAMPROC, DeleteProgram)                            \
+    X(PFNGLUSEPROGRAMPROC, UseProgram)                                  \
+    X(PFNGLGETUNIFORMLOCATIONPROC, GetUniformLocation)                  \
+    X(PFNGLUNIFORM1IPROC, Uniform1i)                                    \
+    X(PFNGLUNIFORM3FVPROC, Uniform3fv)                                  \
+    X(PFNGLUNIFORM4FPROC, Uniform4f)
+
+// Optional: buffer storage (4.4), fences (3.2) and timer queries (3.3).
+#define SCREEN_GL_OPTIONAL(X)                                           \
+    X(PFNGLBUFFERSTORAGEPROC, BufferStorage)                            \
+    X(PFNGLFENCESYNCPROC, FenceSync)                                    \
+    X(PFNGLCLIENTWAITSYNCPROC, ClientWaitSync)                          \
+    X(PFNGLDELETESYNCPROC, DeleteSync)                                  \
+    X(PFNGLGENQUERIESPROC, GenQueries)                                  \
+    X(PFNGLDELETEQUERIESPROC, DeleteQueries)                            \
+    X(PFNGLBEGINQUERYPROC, BeginQuery)                                  \
+    X(PFNGLENDQUERYPROC, EndQuery)                                      \
+    X(PFNGLGETQUERYOBJECTIVPROC, GetQueryObjectiv)                      \
+    X(PFNGLGETQUERYOBJECTUI64VPROC, GetQueryObjectui64v)
+
+#define SCREEN_GL_DECLARE(type, name) type name = nullptr;
+static struct {
+    SCREEN_GL_FUNCTIONS(SCREEN_GL_DECLARE)
+    SCREEN_GL_OPTIONAL(SCREEN_GL_DECLARE)
+} gl;
+#undef SCREEN_GL_DECLARE
+
+static bool loadFunctions() {
+    bool complete = true;
+#define SCREEN_GL_LOAD(type, name) gl.name = reinterpret_cast<type>(SDL_GL_GetProcAddress("gl" #name));
+#define SCREEN_GL_REQUIRE(type, name) SCREEN_GL_LOAD(type, name) complete &= gl.name != nullptr;
+    SCREEN_GL_FUNCTIONS(SCREEN_GL_REQUIRE)
+    SCREEN_GL_OPTIONAL(SCREEN_GL_LOAD)
+#undef SCREEN_GL_REQUIRE
+#undef SCREEN_GL_LOAD
+    return complete;
+}
+
+static bool glAtLeast(int major, int minor) {
+    GLint haveMajor = 0, haveMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &haveMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &haveMinor);
+    return haveMajor > major || (haveMajor == major && haveMinor >= minor);
+}
+
+// The quad comes from gl_VertexID, so there are no vertex buffers.
+static const char *VERTEX_SHADER = R"(
+uniform vec4 rect;
+out vec2 uv;
+void main() {
+    vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+    uv = vec2(corner.x, 1.0 - corner.y);
+    gl_Position = vec4(mix(rect.xy, rect.zw, corner), 0.0, 1.0);
+}
+)";
+
+static const char *FRAGMENT_SHADER = R"(
+uniform sampler2D shades;
+uniform vec3 palette[4];
+in vec2 uv;
+out vec4 color;
+void main() {
+    int shade = int(texture(shades, uv).r * 255.0 + 0.5);
+    color = vec4(palette[shade & 3], 1.0);
+}
+)";
+
+// White to black, in the greens of the original screen.
+static const GLfloat PALETTE[4][3] = {
+    {0.88f, 0.97f, 0.82f}, {0.53f, 0.75f, 0.44f}, {0.20f, 0.41f, 0.34f}, {0.03f, 0.09f, 0.13f},
+};
+
+static GLuint compile(GLenum type, const char *glslVersion, const char *source) {
+    GLuint shader = gl.CreateShader(type);
+    const char *parts[] = {glslVersion, "\n", source};
+    gl.ShaderSource(shader, 3, parts, nullptr);
+    gl.CompileShader(shader);
+    GLint ok = 0;
+    gl.GetShaderiv(shader, GL_COMPILE_STATUS, &ok);
+    if (!ok) {
+        char log[1024];
+        gl.GetShaderInfoLog(shader, sizeof(log), nullptr, log);
+        SDL_Log("Screen shader did not compile: %s", log);
+        gl.DeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
+
+bool Screen::init(const char *glslVersion) {
+    if (!loadFunctions()) {
+        SDL_Log("Screen needs OpenGL 3.0");
+        return false;
+    }
+
+    GLuint vertex = compile(GL_VERTEX_SHADER, glslVersion, VERTEX_SHADER);
+    GLuint fragment = compile(GL_FRAGMENT_SHADER, glslVersion, FRAGMENT_SHADER);
+    if (!vertex || !fragment) return false;
+    program = gl.CreateProgram();
+    gl.AttachShader(program, vertex);
+    gl.AttachShader(program, fragment);
+    gl.LinkProgram(program);
+    gl.DeleteShader(vertex);
+    gl.DeleteShader(fragment);
+    GLint linked = 0;
+    gl.GetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        char log[1024];
+        gl.GetProgramInfoLog(program, sizeof(log), nullptr, log);
+        SDL_Log("Screen shader did not link: %s", log);
+        return false;
+    }
+    gl.UseProgram(program);
+    gl.Uniform1i(gl.GetUniformLocation(program, "shades"), 0);
+    gl.Uniform3fv(gl.GetUniformLocation(program, "palette"), 4, &PALETTE[0][0]);
+    rectUniform = gl.GetUniformLocation(program, "rect");
+    gl.UseProgram(0);
+    gl.GenVertexArrays(1, &vertexArray);
+
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, GBPPU::WIDTH, GBPPU::HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    gl.GenBuffers(1, &buffer);
+    gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    bool storage = gl.BufferStorage && gl.FenceSync && gl.ClientWaitSync && gl.DeleteSync &&
+                   (glAtLeast(4, 4) || SDL_GL_ExtensionSupported("GL_ARB_buffer_storage"));
+    if (storage) {
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        gl.BufferStorage(GL_PIXEL_UNPACK_BUFFER, RING * FRAME_BYTES, nullptr, flags);
+        mapped = static_cast<uint8_t*>(gl.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, RING * FRAME_BYTES, flags));
+    }
+    if (!mapped) gl.BufferData(GL_PIXEL_UNPACK_BUFFER, FRAME_BYTES, nullptr, GL_STREAM_DRAW);
+    gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    timed = gl.GenQueries && gl.BeginQuery && gl.EndQuery && gl.GetQueryObjectiv && gl.GetQueryObjectui64v &&
+            (glAtLeast(3, 3) || SDL_GL_ExtensionSupported("GL_ARB_timer_query"));
+    if (timed) gl.GenQueries(QUERIES, queries);
+    SDL_Log("Screen: %s pixel buffer%s", mapped ? "persistently mapped" : "orphaned",
+            timed ? ", GPU timed" : "");
+    return true;
+}
+
+void Screen::shutdown() {
+    for (void *&fence: fences) {
+        if (fence) gl.DeleteSync(static_cast<GLsync>(fence));
+        fence = nullptr;
+    }
+    if (timed) gl.DeleteQueries(QUERIES, queries);
+    if (buffer) {
+        if (mapped) {
+            gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+            gl.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        gl.DeleteBuffers(1, &buffer);
+    }
+    if (texture) glDeleteTextures(1, &texture);
+    if (vertexArray) gl.DeleteVertexArrays(1, &vertexArray);
+    if (program) gl.DeleteProgram(program);
+    mapped = nullptr;
+    buffer = texture = vertexArray = program = 0;
+}
+
+void Screen::upload(const GBPPU::Frame &frame) {
+    if (!buffer) return;
+    Uint64 start = SDL_GetPerformanceCounter();
+    collectQueries();
+    bool query = timed && queryPending < QUERIES;
+    if (query) gl.BeginQuery(GL_TIME_ELAPSED, queries[(queryHead + queryPending++) % QUERIES]);
+
+    gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, buffer);
+    size_t offset = 0;
+    if (mapped) {
+        // The slot was last read three frames ago, normally long done.
+        slot = (slot + 1) % RING;
+        if (GLsync fence = static_cast<GLsync>(fences[slot])) {
+            gl.ClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GLuint64(1000000000));
+            gl.DeleteSync(fence);
+            fences[slot] = nullptr;
+        }
+        offset = slot * FRAME_BYTES;
+        std::memcpy(mapped + offset, frame.data(), FRAME_BYTES);
+    } else {
+        // Orphaning hands the driver a fresh buffer instead of waiting
+        // for the GPU to finish with the old one.
+        gl.BufferData(GL_PIXEL_UNPACK_BUFFER, FRAME_BYTES, nullptr, GL_STREAM_DRAW);
+        void *target = gl.MapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, FRAME_BYTES,
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (target) {
+            std::memcpy(target, frame.data(), FRAME_BYTES);
+            gl.UnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GBPPU::WIDTH, GBPPU::HEIGHT, GL_RED, GL_UNSIGNED_BYTE,
+                    reinterpret_cast<const void*>(offset));
+    glBindTexture(GL_TEXTURE_2D, 0);
+    if (mapped) fences[slot] = gl.FenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    gl.BindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    if (query) gl.EndQuery(GL_TIME_ELAPSED);
+    average(uploadCpu, microsSince(start));
+}
+
+// Reads back finished GPU timings without ever waiting for one.
+void Screen::collectQueries() {
+    while (queryPending) {
+        GLuint query = queries[queryHead];
+        GLint ready = 0;
+        gl.GetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &ready);
+        if (!ready) return;
+        GLuint64 nanoseconds = 0;
+        gl.GetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+        average(uploadGpu, double(nanoseconds) / 1000);
+        queryHead = (queryHead + 1) % QUERIES;
+        --queryPending;
+    }
+}
+
+void Screen::draw(int width, int height) {
+    if (!program) return;
+    Uint64 start = SDL_GetPerformanceCounter();
+    lastScale = std::max(1, std::min(width / int(GBPPU::WIDTH), height / int(GBPPU::HEIGHT)));
+    float w = float(GBPPU::WIDTH * lastScale) / float(width);
+    float h = float(GBPPU::HEIGHT * lastScale) / float(height);
+    gl.UseProgram(program);
+    gl.Uniform4f(rectUniform, -w, -h, w, h);
+    gl.BindVertexArray(vertexArray);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    gl.BindVertexArray(0);
+    gl.UseProgram(0);
+    average(drawCpu, microsSince(start));
+}
@@ -0,0 +1,528 @@
+#include <apu/GBApu.h>
+#include <apu/RateControl.h>
+#include <apu/SampleRing.h>
+#include <cpu/GBCpu.h>
+#include <memory/GBMemory.h>
+#include <ppu/GBPpu.h>
+#include <state/Rewind.h>
+#include <state/RunAhead.h>
+#include <state/SaveState.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Render-less runner for build farm nodes: executes the core flat out with
+// no throttling and reports throughput.
+
+// --alu-bench runs this instead of a ROM: a loop of flag-producing ALU ops
+// where only ADC/SBC ever look at a flag, i.e. what lazy flags are for.
+static const uint8_t aluBench[] = {
+    0x31, 0xFE, 0xFF,          // 0100 LD SP,FFFE
+    0x01, 0x34, 0x12,          //      LD BC,1234
+    0x11, 0x78, 0x56,          //      LD DE,5678
+    0x21, 0x00, 0xC0,          //      LD HL,C000
+    0x80, 0x89, 0x92, 0x9B,    // 010C ADD A,B; ADC A,C; SUB D; SBC A,E
+    0xA4, 0xAD, 0xB0, 0xB9,    //      AND H; XOR L; OR B; CP C
+    0x3C, 0x05, 0x19, 0x0C,    //      INC A; DEC B; ADD HL,DE; INC C
+    0x86, 0x14, 0x1D,          //      ADD A,(HL); INC D; DEC E
+    0xC6, 0x11, 0xD6, 0x07,    //      ADD A,11; SUB 07
+    0xE6, 0xF3, 0xEE, 0x5A,    //      AND F3; XOR 5A
+    0xF6, 0x81, 0xFE, 0x40,    //      OR 81; CP 40
+    0x2C, 0x25,                //      INC L; DEC H
+    0xC3, 0x0C, 0x01,          //      JP 010C
+};
+
+static uint64_t frameHash(const GBPPU::Frame &frame) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (uint8_t pixel: frame) hash = (hash ^ pixel) * 0x100000001B3ull;
+    return hash;
+}
+
+// What was played, for the report and optionally a WAV file.
+struct AudioSink {
+    FILE *wav = nullptr;
+    uint64_t frames = 0;
+    uint64_t hash = 0xCBF29CE484222325ull;
+    int peak = 0;
+    double micros = 0;
+
+    void take(GBAPU &apu, bool record) {
+        int16_t samples[1024 * GBAPU::CHANNELS];
+        while (size_t count = apu.readSamples(samples, 1024)) {
+            for (size_t i = 0; i < count * GBAPU::CHANNELS; ++i) {
+                hash = (hash ^ uint16_t(samples[i])) * 0x100000001B3ull;
+                peak = std::max(peak, std::abs(int(samples[i])));
+            }
+            if (wav && record) std::fwrite(samples, sizeof(int16_t) * GBAPU::CHANNELS, count, wav);
+            frames += count;
+        }
+    }
+};
+
+// A 16 bit stereo WAV header for bytes of samples, written first as a
+// placeholder and again once the length is known.
+static void writeWavHeader(FILE *file, uint32_t bytes) {
+    auto le = [file](uint32_t value, int size) {
+        for (int i = 0; i < size; ++i) std::fputc(int(value >> (8 * i) & 0xFF), file);
+    };
+    constexpr uint32_t BLOCK = GBAPU::CHANNELS * sizeof(int16_t);
+    std::fseek(file, 0, SEEK_SET);
+    std::fputs("RIFF", file);
+    le(36 + bytes, 4);
+    std::fputs("WAVEfmt ", file);
+    le(16, 4);
+    le(1, 2);
+    le(GBAPU::CHANNELS, 2);
+    le(GBAPU::SAMPLE_RATE, 4);
+    le(GBAPU::SAMPLE_RATE * BLOCK, 4);
+    le(BLOCK, 2);
+    le(16, 2);
+    std::fputs("data", file);
+    le(bytes, 4);
+}
+
+static void usage(const char *prog) {
+    std::fprintf(stderr,
+                 "usage: %s <rom>|--alu-bench [--instructions N | --cycles N | --frames N]\n"
+                 "       [--dispatch threaded|table|block|dynarec] [--lockstep] [--instances N]\n"
+                 "       [--save FILE] [--state-bench N] [--rewind-bench N] [--run-ahead K]\n"
+                 "       [--no-video] [--ppu-check] [--no-audio] [--wav FILE] [--audio-sync HZ]\n"
+                 "--lockstep checks every translated block against the interpreter\n"
+                 "--instances runs N machines one after another over one shared ROM image\n"
+                 "--save keeps the (first) machine's battery RAM in FILE, flushed every emulated second\n"
+                 "--state-bench times N save states and restores, then N frames of delta checkpoints\n"
+                 "--rewind-bench captures N frames of rewind, then rewinds them all and checks the result\n"
+                 "--run-ahead runs whole frames, each presenting the one K frames ahead, and reports the cost\n"
+                 "--no-video runs the CPU without drawing any lines\n"
+                 "--no-audio runs without the APU; --wav writes what the (first) machine played to FILE\n"
+                 "--audio-sync runs the frames again as a host showing one per vsync at HZ would, feeding\n"
+                 "             a 48 kHz device, without and with rate control, and reports the queue\n"
+                 "--ppu-check compares every SIMD tile kernel with the scalar one, then draws the last frame\n"
+                 "            with each and compares and times those\n", prog);
+}
+
+struct Options {
+    const char *romPath = nullptr;
+    uint64_t instructionBudget = 0;
+    uint64_t cycleBudget = 60 * GBCPU::CYCLES_PER_FRAME;
+    GBCPU::Dispatch dispatch = GBCPU::defaultDispatch;
+    bool lockstep = false;
+    size_t instanceCount = 1;
+    const char *savePath = nullptr;
+    uint64_t stateBench = 0;
+    uint64_t rewindBench = 0;
+    unsigned runAhead = 0;
+    bool video = true;
+    bool ppuCheck = false;
+    bool audio = true;
+    const char *wavPath = nullptr;
+    double audioSyncHz = 0;
+};
+
+static bool parseOptions(int argc, char **argv, Options &options) {
+    if (argc < 2) return false;
+    options.romPath = argv[1];
+    for (int i = 2; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--instructions") && i + 1 < argc) {
+            options.instructionBudget = std::strtoull(argv[++i], nullptr, 10);
+            options.cycleBudget = 0;
+        } else if (!std::strcmp(argv[i], "--cycles") && i + 1 < argc) {
+            options.cycleBudget = std::strtoull(argv[++i], nullptr, 10);
+            options.instructionBudget = 0;
+        } else if (!std::strcmp(argv[i], "--frames") && i + 1 < argc) {
+            options.cycleBudget = std::strtoull(argv[++i], nullptr, 10) * GBCPU::CYCLES_PER_FRAME;
+            options.instructionBudget = 0;
+        } else if (!std::strcmp(argv[i], "--dispatch") && i + 1 < argc) {
+            ++i;
+            if (!std::strcmp(argv[i], "threaded")) options.dispatch = GBCPU::Dispatch::Threaded;
+            else if (!std::strcmp(argv[i], "table")) options.dispatch = GBCPU::Dispatch::Table;
+            else if (!std::strcmp(argv[i], "block")) options.dispatch = GBCPU::Dispatch::Block;
+            else if (!std::strcmp(argv[i], "dynarec")) options.dispatch = GBCPU::Dispatch::Dynarec;
+            else return false;
+        } else if (!std::strcmp(argv[i], "--lockstep")) {
+            options.lockstep = true;
+        } else if (!std::strcmp(argv[i], "--save") && i + 1 < argc) {
+            options.savePath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--state-bench") && i + 1 < argc) {
+            options.stateBench = std::strtoull(argv[++i], nullptr, 10);
+        } else if (!std::strcmp(argv[i], "--rewind-bench") && i + 1 < argc) {
+            options.rewindBench = std::strtoull(argv[++i], nullptr, 10);
+        } else if (!std::strcmp(argv[i], "--run-ahead") && i + 1 < argc) {
+            options.runAhead = unsigned(std::strtoul(argv[++i], nullptr, 10));
+        } else if (!std::strcmp(argv[i], "--no-video")) {
+            options.video = false;
+        } else if (!std::strcmp(argv[i], "--ppu-check")) {
+            options.ppuCheck = true;
+        } else if (!std::strcmp(argv[i], "--no-audio")) {
+            options.audio = false;
+        } else if (!std::strcmp(argv[i], "--wav") && i + 1 < argc) {
+            options.wavPath = argv[++i];
+        } else if (!std::strcmp(argv[i], "--audio-sync") && i + 1 < argc) {
+            options.audioSyncHz = std::strtod(argv[++i], nullptr);
+        } else if (!std::strcmp(argv[i], "--instances") && i + 1 < argc) {
+            options.instanceCount = std::max<size_t>(1, std::strtoull(argv[++i], nullptr, 10));
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct Instance {
+    GBMEM mem;
+    GBCPU cpu;
+    GBPPU ppu;
+    GBAPU apu;
+};
+using Instances = std::vector<std::unique_ptr<Instance>>;
+
+// What the timed run adds up over all instances.
+struct Totals {
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    double seconds = 0;
+    uint64_t runAheadFrames = 0;
+    double runAheadMicros = 0;
+};
+
+static bool runInstances(const Options &options, Instances &instances, AudioSink &sound, Totals &totals) {
+    auto start = std::chrono::steady_clock::now();
+    for (auto &instance: instances) {
+        GBMEM &mem = instance->mem;
+        GBCPU &cpu = instance->cpu;
+        GBPPU &ppu = instance->ppu;
+        GBAPU &apu = instance->apu;
+        auto play = [&] {
+            auto playStart = std::chrono::steady_clock::now();
+            apu.run(mem);
+            sound.micros += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                                      playStart).count();
+            // Only the first machine's sound goes to the file.
+            sound.take(apu, instance == instances.front());
+        };
+        if (options.instructionBudget) {
+            uint16_t pc = cpu.PC();
+            for (uint64_t i = 0; i < options.instructionBudget; ++i) {
+                pc = cpu.parseInstruction(mem, pc);
+            }
+            cpu.PC(pc);
+        } else if (options.runAhead) {
+            struct Frame {
+                GBCPU &cpu;
+                GBMEM &mem;
+                GBPPU &ppu;
+                GBCPU::Dispatch dispatch;
+                bool video;
+                bool audio;
+                decltype(play) &played;
+            } frame{cpu, mem, ppu, options.dispatch, options.video, options.audio, play};
+            RunAhead ahead(options.runAhead);
+            while (cpu.cycleCount() < options.cycleBudget) {
+                bool restored = ahead.runFrame(cpu, mem, [](void *context, bool picture, bool sound) {
+                    Frame &frame = *static_cast<Frame*>(context);
+                    frame.ppu.runFrame(frame.cpu, frame.mem, frame.dispatch, frame.video && picture);
+                    if (frame.audio && sound) frame.played();
+                }, &frame);
+                if (!restored) return false;
+                totals.runAheadMicros += ahead.lastExtraMicros();
+                if (++totals.runAheadFrames % 60 == 0) mem.flushSave(false);
+            }
+        } else {
+            // Slices of one emulated second, each ending in a save flush.
+            while (cpu.cycleCount() < options.cycleBudget) {
+                ppu.run(cpu, mem, std::min<uint64_t>(options.cycleBudget - cpu.cycleCount(),
+                                                     GBCPU::CYCLES_PER_SECOND),
+                        options.dispatch, options.video);
+                if (options.audio) play();
+                mem.flushSave(false);
+            }
+        }
+        mem.flushSave(true);
+        totals.instructions += cpu.instructionCount();
+        totals.cycles += cpu.cycleCount();
+    }
+    totals.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return true;
+}
+
+static void report(const Options &options, const RomImage &image, const Instances &instances,
+                   const AudioSink &sound, const Totals &totals) {
+    const GBCPU &cpu = instances.front()->cpu;
+    double seconds = totals.seconds;
+    double cycles = double(totals.cycles);
+    double frames = cycles / GBCPU::CYCLES_PER_FRAME;
+    std::printf("rom:          %s\n", options.romPath);
+    const char *dispatchName = "table";
+    if (options.instructionBudget) dispatchName = "step";
+    else if (options.dispatch == GBCPU::Dispatch::Block) dispatchName = "block";
+    else if (options.dispatch == GBCPU::Dispatch::Dynarec) dispatchName = Dynarec::available ? "dynarec" : "block";
+    else if (options.dispatch == GBCPU::Dispatch::Threaded && GBCPU::threadedDispatch) dispatchName = "threaded";
+    std::printf("dispatch:     %s\n", dispatchName);
+    std::printf("instructions: %llu\n", (unsigned long long)totals.instructions);
+    std::printf("m-cycles:     %llu\n", (unsigned long long)totals.cycles);
+    std::printf("frames:       %.1f\n", frames);
+    std::printf("events:       %llu run, %llu interrupts taken\n",
+                (unsigned long long)instances.front()->mem.eventCount(), (unsigned long long)cpu.interruptCount());
+    std::printf("skipped:      %llu m-cycles halted or polling\n", (unsigned long long)cpu.skippedCycles());
+    std::printf("wall time:    %.3f s\n", seconds);
+    std::printf("emulated:     %.2f MIPS\n", totals.instructions / seconds / 1e6);
+    std::printf("              %.2f M-cycles/s\n", cycles / seconds / 1e6);
+    std::printf("              %.1f frames/s (%.1fx real time)\n",
+                frames / seconds, cycles / seconds / GBCPU::CYCLES_PER_SECOND);
+    if (options.instanceCount > 1) {
+        // The image stays shared; each instance adds only its own state.
+        std::printf("instances:    %zu sharing one %zu KB %s image, %zu KB each + %zu KB cart RAM\n",
+                    options.instanceCount, image.size() / 1024, image.mapped() ? "mapped" : "copied",
+                    sizeof(GBMEM) / 1024, instances.front()->mem.cartridge().ramSize() / 1024);
+    }
+    if (options.dispatch == GBCPU::Dispatch::Block || options.dispatch == GBCPU::Dispatch::Dynarec) {
+        std::printf("blocks:       %zu cached, %llu invalidated\n", cpu.blocks().size(),
+                    (unsigned long long)cpu.blocks().invalidations());
+    }
+    const Dynarec &dynarec = cpu.recompiler();
+    if (options.dispatch == GBCPU::Dispatch::Dynarec) {
+        std::printf("native:       %zu blocks, %zu interpreted, %zu links, %zu bytes, %llu flushes\n",
+                    dynarec.translated(), dynarec.rejected(), dynarec.links(), dynarec.codeBytes(),
+                    (unsigned long long)dynarec.flushes());
+    }
+    const GBPPU &ppu = instances.front()->ppu;
+    if (options.video) {
+        std::printf("video:        %llu frames drawn with the %s kernels, last frame %016llx\n",
+                    (unsigned long long)ppu.framesDrawn(), TileDecoder::name(ppu.tiles().kernel()),
+                    (unsigned long long)frameHash(ppu.frame()));
+    }
+    if (options.audio) {
+        const GBAPU &apu = instances.front()->apu;
+        double played = double(sound.frames) / GBAPU::SAMPLE_RATE;
+        std::printf("audio:        %llu samples (%.2f s) at %u Hz, peak %d, %llu dropped, hash %016llx\n",
+                    (unsigned long long)sound.frames, played, GBAPU::SAMPLE_RATE, sound.peak,
+                    (unsigned long long)apu.samplesDropped(), (unsigned long long)sound.hash);
+        std::printf("              %.1f us per emulated second (%.3f%% of real time)\n",
+                    sound.micros / (cycles / GBCPU::CYCLES_PER_SECOND),
+                    sound.micros / 1e4 / (cycles / GBCPU::CYCLES_PER_SECOND));
+    }
+}
+
+// The kernels alone, then whole frames of what the ROM left in VRAM.
+static bool runPpuCheck(GBMEM &mem) {
+    GBPPU scalar(TileDecoder::Kernel::Scalar);
+    for (unsigned line = 0; line < GBPPU::HEIGHT; ++line) scalar.drawLine(mem, line);
+    bool exact = true;
+    for (auto kernel: {TileDecoder::Kernel::Scalar, TileDecoder::Kernel::SSSE3, TileDecoder::Kernel::AVX2}) {
+        if (!TileDecoder::supported(kernel)) {
+            std::printf("ppu check:    %-6s not supported here\n", TileDecoder::name(kernel));
+            continue;
+        }
+        size_t differing = TileDecoder::mismatches(kernel);
+        GBPPU checked(kernel);
+        constexpr int REPEATS = 1000;
+        auto drawStart = std::chrono::steady_clock::now();
+        for (int i = 0; i < REPEATS; ++i) {
+            for (unsigned line = 0; line < GBPPU::HEIGHT; ++line) checked.drawLine(mem, line);
+        }
+        double drawUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                                  drawStart).count() / REPEATS;
+        bool same = checked.frame() == scalar.frame();
+        std::printf("ppu check:    %-6s %zu kernel mismatches, frame %s, %.2f us per frame\n",
+                    TileDecoder::name(kernel), differing, same ? "identical" : "DIFFERS", drawUs);
+        exact &= !differing && same;
+    }
+    return exact;
+}
+
+// The wall time of the run includes the frames run ahead.
+static void reportRunAhead(const Options &options, const Totals &totals) {
+    double frameUs = 1e6 * GBCPU::CYCLES_PER_FRAME / GBCPU::CYCLES_PER_SECOND;
+    double extraUs = totals.runAheadMicros / totals.runAheadFrames;
+    double realUs = (totals.seconds * 1e6 - totals.runAheadMicros) / totals.runAheadFrames;
+    std::printf("run-ahead:    K=%u, +%.2f us per frame (%.2fx the real frame, %.2f%% of a frame's time)\n",
+                options.runAhead, extraUs, extraUs / realUs, 100 * extraUs / frameUs);
+}
+
+static bool runStateBench(const Options &options, GBCPU &cpu, GBMEM &mem) {
+    uint64_t count = options.stateBench;
+    std::vector<uint8_t> state;
+    auto saveStart = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < count; ++i) SaveState::save(cpu, mem, state);
+    auto loadStart = std::chrono::steady_clock::now();
+    bool restored = true;
+    for (uint64_t i = 0; i < count; ++i) restored &= SaveState::load(cpu, mem, state);
+    auto loadEnd = std::chrono::steady_clock::now();
+    double saveUs = std::chrono::duration<double, std::micro>(loadStart - saveStart).count() / count;
+    double loadUs = std::chrono::duration<double, std::micro>(loadEnd - loadStart).count() / count;
+    std::printf("save state:   %zu bytes, save %.2f us, load %.2f us (%.0f loads/s)\n",
+                state.size(), saveUs, loadUs, 1e6 / loadUs);
+
+    // Per frame checkpoints: a base every second, a delta every frame.
+    std::vector<uint8_t> base, delta;
+    double deltaSaveUs = 0;
+    size_t deltaBytes = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        if (i % 60 == 0) SaveState::saveBase(cpu, mem, base);
+        cpu.run(mem, GBCPU::CYCLES_PER_FRAME, options.dispatch);
+        auto deltaStart = std::chrono::steady_clock::now();
+        SaveState::saveDelta(cpu, mem, delta);
+        deltaSaveUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                                  deltaStart).count();
+        deltaBytes += delta.size();
+    }
+    auto deltaLoadStart = std::chrono::steady_clock::now();
+    for (uint64_t i = 0; i < count; ++i) restored &= SaveState::loadDelta(cpu, mem, base, delta);
+    double deltaLoadUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                                   deltaLoadStart).count() / count;
+    std::printf("frame delta:  %zu bytes average, save %.2f us, base + delta load %.2f us\n",
+                deltaBytes / count, deltaSaveUs / count, deltaLoadUs);
+    return restored;
+}
+
+static bool runRewindBench(const Options &options, GBCPU &cpu, GBMEM &mem) {
+    uint64_t count = options.rewindBench;
+    Rewind rewind(64 << 20, count);
+    std::vector<uint8_t> first, rewound;
+    rewind.capture(cpu, mem);
+    SaveState::save(cpu, mem, first);
+    double captureUs = 0;
+    for (uint64_t i = 0; i < count; ++i) {
+        cpu.run(mem, GBCPU::CYCLES_PER_FRAME, options.dispatch);
+        auto captureStart = std::chrono::steady_clock::now();
+        rewind.capture(cpu, mem);
+        captureUs += std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                               captureStart).count();
+    }
+    size_t frames = rewind.frames(), bytes = rewind.bytesUsed();
+    auto stepStart = std::chrono::steady_clock::now();
+    while (rewind.stepBack(cpu, mem)) {}
+    double stepUs = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() -
+                                                              stepStart).count() / frames;
+    SaveState::save(cpu, mem, rewound);
+    double frameUs = 1e6 * GBCPU::CYCLES_PER_FRAME / GBCPU::CYCLES_PER_SECOND;
+    std::printf("rewind:       %zu frames in %zu KB (%zu bytes/frame), capture %.2f us (%.3f%% of a frame)\n",
+                frames, bytes / 1024, bytes / frames, captureUs / count, 100 * captureUs / count / frameUs);
+    std::printf("              step back %.2f us (%.0fx real time), %s\n", stepUs, frameUs / stepUs,
+                rewound == first ? "back at the first frame" : "DID NOT RETURN TO THE FIRST FRAME");
+    return rewound == first;
+}
+
+// Runs the frames on a fresh machine as a host showing one per vsync would.
+// The device starts once the target is queued and then reads a chunk
+// whenever it has played one, on its own clock.
+static bool runAudioSync(const Options &options, const RomImage::Handle &image) {
+    constexpr size_t CHUNK = 512;
+    constexpr size_t TARGET = GBAPU::SAMPLE_RATE * 60 / 1000;
+    constexpr double MS_PER_FRAME = 1000.0 / GBAPU::SAMPLE_RATE;
+    double hz = options.audioSyncHz;
+    uint64_t hostFrames = options.cycleBudget / GBCPU::CYCLES_PER_FRAME;
+    bool held = true;
+    for (bool controlled: {false, true}) {
+        GBMEM mem;
+        mem.insert(image);
+        GBCPU cpu;
+        cpu.PC(0x0100);
+        GBPPU ppu;
+        GBAPU apu;
+        apu.attach(mem);
+        SampleRing ring(8192);
+        RateControl control(TARGET);
+        int16_t samples[CHUNK * GBAPU::CHANNELS];
+        bool playing = false;
+        double owed = 0;
+        uint64_t underruns = 0, overruns = 0, settledFrames = 0;
+        size_t lowest = SIZE_MAX, highest = 0;
+        double lowRatio = 2, highRatio = 0, settledLevel = 0;
+        for (uint64_t frame = 0; frame < hostFrames; ++frame) {
+            if (controlled) apu.setResampleRatio(control.update(ring.available()));
+            ppu.runFrame(cpu, mem, options.dispatch, false);
+            apu.run(mem);
+            while (size_t count = apu.readSamples(samples, CHUNK)) overruns += count - ring.write(samples, count);
+            playing |= ring.available() >= TARGET;
+            if (!playing) continue;
+            owed += GBAPU::SAMPLE_RATE / hz;
+            for (; owed >= CHUNK; owed -= CHUNK) underruns += ring.read(samples, CHUNK) < CHUNK;
+            lowest = std::min(lowest, ring.available());
+            highest = std::max(highest, ring.available());
+            lowRatio = std::min(lowRatio, apu.resampleRatio());
+            highRatio = std::max(highRatio, apu.resampleRatio());
+            if (frame >= hostFrames / 2) {
+                settledLevel += double(ring.available());
+                ++settledFrames;
+            }
+        }
+        std::printf("audio sync:   %.2f Hz host, rate control %-3s %llu underruns, %llu samples dropped, "
+                    "queue %.1f-%.1f ms\n", hz, controlled ? "on:" : "off:",
+                    (unsigned long long)underruns, (unsigned long long)overruns, lowest * MS_PER_FRAME,
+                    highest * MS_PER_FRAME);
+        if (!controlled) continue;
+        std::printf("              target %.0f ms, second half average %.1f ms, ratio %.5f-%.5f\n",
+                    TARGET * MS_PER_FRAME, settledFrames ? settledLevel / settledFrames * MS_PER_FRAME : 0.0,
+                    lowRatio, highRatio);
+        held = !underruns && !overruns;
+    }
+    return held;
+}
+
+static bool reportLockstep(const Dynarec &dynarec) {
+    std::printf("lockstep:     %llu checks, %llu mismatches\n",
+                (unsigned long long)dynarec.lockstepChecks(),
+                (unsigned long long)dynarec.lockstepMismatches());
+    return !dynarec.lockstepMismatches();
+}
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    RomImage::Handle image;
+    if (!std::strcmp(options.romPath, "--alu-bench")) {
+        options.romPath = "(alu bench)";
+        static uint8_t bench[0x8000];
+        std::memcpy(bench + 0x0100, aluBench, sizeof(aluBench));
+        image = RomImage::copy(bench, sizeof(bench), options.romPath);
+    } else {
+        image = RomImage::open(options.romPath);
+    }
+    if (!image) return EXIT_FAILURE;
+
+    Instances instances;
+    for (size_t i = 0; i < options.instanceCount; ++i) {
+        instances.push_back(std::make_unique<Instance>());
+        instances.back()->mem.insert(image);
+        instances.back()->cpu.PC(0x0100);
+        instances.back()->cpu.recompiler().setLockstep(options.lockstep);
+        if (options.audio) instances.back()->apu.attach(instances.back()->mem);
+    }
+    GBCPU &cpu = instances.front()->cpu;
+    GBMEM &mem = instances.front()->mem;
+    if (options.savePath && !mem.attachSave(options.savePath)) return EXIT_FAILURE;
+    AudioSink sound;
+    if (options.audio && options.wavPath) {
+        sound.wav = std::fopen(options.wavPath, "wb");
+        if (!sound.wav) {
+            std::fprintf(stderr, "cannot write %s\n", options.wavPath);
+            return EXIT_FAILURE;
+        }
+        writeWavHeader(sound.wav, 0);
+    }
+
+    Totals totals;
+    if (!runInstances(options, instances, sound, totals)) return EXIT_FAILURE;
+    report(options, *image, instances, sound, totals);
+    if (sound.wav) {
+        writeWavHeader(sound.wav, uint32_t(sound.frames * GBAPU::CHANNELS * sizeof(int16_t)));
+        std::fclose(sound.wav);
+    }
+    if (options.ppuCheck && !runPpuCheck(mem)) return EXIT_FAILURE;
+    if (options.runAhead && totals.runAheadFrames) reportRunAhead(options, totals);
+    if (options.stateBench && !runStateBench(options, cpu, mem)) return EXIT_FAILURE;
+    if (options.rewindBench && !runRewindBench(options, cpu, mem)) return EXIT_FAILURE;
+    if (options.audioSyncHz > 0 && !runAudioSync(options, image)) return EXIT_FAILURE;
+    if (cpu.recompiler().lockstepEnabled() && !reportLockstep(cpu.recompiler())) return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
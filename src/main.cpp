@@ -1,4 +1,3 @@
-#include <string>
 #define SDL_MAIN_USE_CALLBACKS 1
 #include <SDL3/SDL.h>
 #include <SDL3/SDL_main.h>
@@ -8,24 +7,207 @@
 #include <imgui_impl_sdl3.h>
 #include <imgui_impl_opengl3.h>
 
+#include <apu/GBApu.h>
+#include <apu/RateControl.h>
+#include <apu/SampleRing.h>
 #include <cpu/GBCpu.h>
+#include <frontend/Screen.h>
+#include <memory/GBMemory.h>
+#include <ppu/GBPpu.h>
+#include <state/Rewind.h>
+#include <state/RunAhead.h>
+#include <utils/TripleBuffer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
 
 static SDL_Window *window = nullptr;
 SDL_GLContext gl_context;
-bool show_demo_window = false;
-bool show_another_window = true;
 bool show_register_info = true;
-ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
-ImGuiIO *io;
+bool show_frame_timing = true;
+static Screen screen;
+static constexpr int WINDOW_SCALE = 4;
+
+// Frame timing, in microseconds, for the last TIMING_FRAMES iterations.
+static constexpr int TIMING_FRAMES = 120;
+static float frameTimes[TIMING_FRAMES];
+static float uploadTimes[TIMING_FRAMES];
+static float audioLevels[TIMING_FRAMES];
+static float audioRatios[TIMING_FRAMES];
+static int timingAt = 0;
+static Uint64 lastIteration = 0;
+static uint64_t framesRepeated = 0;
+
+// The machine, run on its own thread while a ROM is loaded, a frame at a
+// time, shown run-ahead frames ahead when that is on. Holding the rewind
+// key steps back one frame at a time instead. Only that thread touches the
+// machine: the controls reach it through atomics, and each frame comes back
+// through the triple buffer with what the windows show of the machine, so
+// a slow swap or a busy UI never holds up emulation, nor the other way
+// round.
+static GBMEM mem;
+static GBCPU cpu;
+static GBPPU ppu;
+static GBAPU apu;
+static Rewind history;
+static RunAhead runAhead;
+static bool romLoaded = false;
+static constexpr SDL_Scancode REWIND_KEY = SDL_SCANCODE_BACKSPACE;
+static constexpr int MAX_RUN_AHEAD = 4;
+
+// A finished frame and the state of the machine at its end.
+struct Presented {
+    GBPPU::Frame pixels{};
+    uint16_t af = 0, bc = 0, de = 0, hl = 0, sp = 0, pc = 0;
+    double rewindSeconds = 0;
+    size_t rewindBytes = 0;
+    bool rewinding = false;
+    double runAheadExtra = 0, runAheadFrame = 0;
+    double emulateMicros = 0;
+    double resampleRatio = 1;
+    uint64_t samplesDropped = 0;
+};
+static TripleBuffer<Presented> presented;
+static std::thread emulation;
+static std::atomic<bool> emulating{false};
+static std::atomic<uint8_t> heldButtons{0};
+static std::atomic<bool> rewindHeld{false};
+static std::atomic<int> runAheadSetting{0};
+static int runAheadFrames = 0;
+
+// A frame every CYCLES_PER_FRAME of the Game Boy's clock, 59.73 a second,
+// whatever the display runs at. More than a few frames behind (a stall, a
+// suspended machine) the pace starts again from now rather than racing to
+// catch up.
+static constexpr Uint64 FRAME_NS = Uint64(GBCPU::CYCLES_PER_FRAME) * 1000000000 / GBCPU::CYCLES_PER_SECOND;
+static constexpr Uint64 MAX_FRAMES_BEHIND = 4;
+
+static constexpr struct {
+    SDL_Scancode key;
+    GBMEM::Button button;
+} keyMap[] = {
+    {SDL_SCANCODE_RIGHT, GBMEM::RIGHT}, {SDL_SCANCODE_LEFT, GBMEM::LEFT},
+    {SDL_SCANCODE_UP, GBMEM::UP}, {SDL_SCANCODE_DOWN, GBMEM::DOWN},
+    {SDL_SCANCODE_X, GBMEM::A}, {SDL_SCANCODE_Z, GBMEM::B},
+    {SDL_SCANCODE_RSHIFT, GBMEM::SELECT}, {SDL_SCANCODE_RETURN, GBMEM::START},
+};
+
+// Sound goes from the emulation to the device through the ring: this side
+// never waits for the device, and the device's callback never takes a lock.
+// About 170 ms of room. Frames are paced by the host's timer, whose clock
+// drifts from the audio device's, so with rate control on the resampling is
+// stretched to keep the ring at the target; the device starts once the
+// target is first reached.
+static constexpr size_t AUDIO_CHUNK = 512;
+static constexpr int DEFAULT_LATENCY_MS = 60;
+static SampleRing audioRing(8192);
+static SDL_AudioStream *audioStream = nullptr;
+static bool audioStarted = false;
+static std::atomic<uint64_t> audioUnderruns{0};
+static uint64_t audioOverruns = 0;
+static std::atomic<bool> rateControl{true};
+static std::atomic<size_t> audioTarget{GBAPU::SAMPLE_RATE * DEFAULT_LATENCY_MS / 1000};
+static RateControl audioRate(audioTarget);
+static bool rateControlShown = true;
+static int targetLatencyMs = DEFAULT_LATENCY_MS;
+
+// Frames that are not shown are not drawn, and only real ones are played.
+static void emulateFrame(void *, bool picture, bool sound) {
+    ppu.runFrame(cpu, mem, GBCPU::defaultDispatch, picture);
+    if (!sound) return;
+    audioRate.setTarget(audioTarget.load(std::memory_order_relaxed));
+    bool controlled = rateControl.load(std::memory_order_relaxed);
+    apu.setResampleRatio(controlled ? audioRate.update(audioRing.available()) : 1.0);
+    apu.run(mem);
+    int16_t samples[AUDIO_CHUNK * GBAPU::CHANNELS];
+    while (size_t frames = apu.readSamples(samples, AUDIO_CHUNK)) {
+        audioOverruns += frames - audioRing.write(samples, frames);
+    }
+    if (audioStream && !audioStarted && audioRing.available() >= audioRate.target()) {
+        audioStarted = SDL_ResumeAudioStreamDevice(audioStream);
+    }
+}
+
+static void emulate() {
+    Uint64 deadline = SDL_GetTicksNS();
+    while (emulating.load(std::memory_order_relaxed)) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        mem.setButtons(heldButtons.load(std::memory_order_relaxed));
+        bool rewinding = rewindHeld.load(std::memory_order_relaxed);
+        if (rewinding) {
+            // Stays on the oldest frame once the history runs out. The
+            // frame is redrawn from the restored memory, without whatever
+            // changed between its lines. Rewinding is silent; the APU picks
+            // the channels up from the registers when play resumes.
+            history.stepBack(cpu, mem);
+            for (unsigned line = 0; line < GBPPU::HEIGHT; ++line) ppu.drawLine(mem, line);
+        } else {
+            runAhead.setFrames(unsigned(runAheadSetting.load(std::memory_order_relaxed)));
+            runAhead.runFrame(cpu, mem, emulateFrame, nullptr);
+            // Back on the real timeline, which is what rewinds.
+            history.capture(cpu, mem);
+        }
 
-SDL_AppResult SDL_AppInit(void **, int, char **) {
+        Presented &out = presented.back();
+        out.pixels = ppu.frame();
+        out.af = cpu.AF(), out.bc = cpu.BC(), out.de = cpu.DE();
+        out.hl = cpu.HL(), out.sp = cpu.SP(), out.pc = cpu.PC();
+        out.rewindSeconds = history.frames() / 60.0;
+        out.rewindBytes = history.bytesUsed();
+        out.rewinding = rewinding;
+        out.runAheadExtra = runAhead.extraMicros();
+        out.runAheadFrame = runAhead.frameMicros();
+        out.resampleRatio = apu.resampleRatio();
+        out.samplesDropped = audioOverruns + apu.samplesDropped();
+        out.emulateMicros = double(SDL_GetPerformanceCounter() - start) * 1e6 / double(SDL_GetPerformanceFrequency());
+        presented.publish();
+
+        deadline += FRAME_NS;
+        Uint64 now = SDL_GetTicksNS();
+        if (now < deadline) SDL_DelayPrecise(deadline - now);
+        else if (now - deadline > MAX_FRAMES_BEHIND * FRAME_NS) deadline = now;
+    }
+}
+
+// On SDL's audio thread, whenever the device wants more. A shortfall is
+// filled by holding the last sample, a flat spot rather than a click.
+static void SDLCALL feedAudio(void *, SDL_AudioStream *stream, int additional, int) {
+    static int16_t samples[AUDIO_CHUNK * GBAPU::CHANNELS];
+    static int16_t last[GBAPU::CHANNELS];
+    size_t wanted = size_t(additional) / sizeof(samples[0]) / GBAPU::CHANNELS;
+    while (wanted) {
+        size_t frames = std::min(wanted, AUDIO_CHUNK);
+        size_t got = audioRing.read(samples, frames);
+        if (got) std::copy_n(samples + (got - 1) * GBAPU::CHANNELS, GBAPU::CHANNELS, last);
+        if (got < frames) audioUnderruns.fetch_add(1, std::memory_order_relaxed);
+        for (size_t i = got; i < frames; ++i) std::copy_n(last, GBAPU::CHANNELS, samples + i * GBAPU::CHANNELS);
+        SDL_PutAudioStreamData(stream, samples, int(frames * GBAPU::CHANNELS * sizeof(samples[0])));
+        wanted -= frames;
+    }
+}
+
+SDL_AppResult SDL_AppInit(void **, int argc, char **argv) {
     SDL_SetAppMetadata("GBEmulator", "1.0", "com.example.gbemulator");
 
+    if (argc > 1) {
+        romLoaded = mem.loadROM(argv[1]);
+        if (!romLoaded) return SDL_APP_FAILURE;
+        cpu.PC(0x0100);
+        apu.attach(mem);
+    }
+
     if (!SDL_Init(SDL_INIT_VIDEO | SDL_INIT_GAMEPAD | SDL_INIT_AUDIO)) {
         SDL_Log("Couldn't initialize SDL: %s", SDL_GetError());
         return SDL_APP_FAILURE;
     }
 
+    if (romLoaded) {
+        const SDL_AudioSpec audioSpec = {SDL_AUDIO_S16, GBAPU::CHANNELS, GBAPU::SAMPLE_RATE};
+        audioStream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &audioSpec, feedAudio, nullptr);
+        if (!audioStream) SDL_Log("No audio: %s", SDL_GetError());
+    }
+
 #if defined (__APPLE__)
     const char * glsl_version = "#version 150";
     SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_FORWARD_COMPATIBLE_FLAG);
@@ -46,7 +228,8 @@ SDL_AppResult SDL_AppInit(void **, int, char **) {
 
     float main_scale = SDL_GetDisplayContentScale(SDL_GetPrimaryDisplay());
     SDL_WindowFlags window_flags = SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_HIDDEN | SDL_WINDOW_HIGH_PIXEL_DENSITY;
-    window = SDL_CreateWindow("Dear ImGui SDL3+OpenGL3 example", (int)(500 * main_scale), (int)(500 * main_scale), window_flags);
+    window = SDL_CreateWindow("GBEmulator", (int)(GBPPU::WIDTH * WINDOW_SCALE * main_scale),
+                              (int)(GBPPU::HEIGHT * WINDOW_SCALE * main_scale), window_flags);
     if (window == nullptr)
     {
         SDL_Log("Error: SDL_CreateWindow(): %s\n", SDL_GetError());
@@ -83,6 +266,7 @@ SDL_AppResult SDL_AppInit(void **, int, char **) {
     // Setup Platform/Renderer backends
     ImGui_ImplSDL3_InitForOpenGL(window, gl_context);
     ImGui_ImplOpenGL3_Init(glsl_version);
+    if (!screen.init(glsl_version)) return SDL_APP_FAILURE;
 
     // Load Fonts
     // - If no fonts are loaded, dear imgui will use the default font. You can also load multiple fonts and use ImGui::PushFont()/PopFont() to select them.
@@ -101,6 +285,11 @@ SDL_AppResult SDL_AppInit(void **, int, char **) {
     //ImFont* font = io.Fonts->AddFontFromFileTTF("c:\\Windows\\Fonts\\ArialUni.ttf");
     //IM_ASSERT(font != nullptr);
 
+    if (romLoaded) {
+        emulating = true;
+        emulation = std::thread(emulate);
+    }
+
     return SDL_APP_CONTINUE;  /* carry on with the program! */
 }
 
@@ -123,62 +312,98 @@ SDL_AppResult SDL_AppEvent(void *, SDL_Event *event)
 /* This function runs once per frame, and is the heart of the program. */
 SDL_AppResult SDL_AppIterate(void *)
 {
+    Uint64 iterationStart = SDL_GetPerformanceCounter();
+    double frequency = double(SDL_GetPerformanceFrequency());
+    if (lastIteration) frameTimes[timingAt] = float(double(iterationStart - lastIteration) * 1e6 / frequency);
+    lastIteration = iterationStart;
+
+    if (romLoaded) {
+        const bool *keys = SDL_GetKeyboardState(nullptr);
+        bool playing = !ImGui::GetIO().WantCaptureKeyboard;
+        uint8_t buttons = 0;
+        for (const auto &mapping: keyMap) {
+            if (playing && keys[mapping.key]) buttons |= mapping.button;
+        }
+        heldButtons.store(buttons, std::memory_order_relaxed);
+        rewindHeld.store(playing && keys[REWIND_KEY], std::memory_order_relaxed);
+        // The newest finished frame, if one came since the last iteration;
+        // otherwise the last one stays up.
+        if (presented.take()) screen.upload(presented.front().pixels);
+        else ++framesRepeated;
+    }
+    const Presented &shown = presented.front();
+    uploadTimes[timingAt] = float(screen.uploadMicros());
+    audioLevels[timingAt] = float(audioRing.available() * 1000.0 / GBAPU::SAMPLE_RATE);
+    audioRatios[timingAt] = float((shown.resampleRatio - 1) * 100);
+    timingAt = (timingAt + 1) % TIMING_FRAMES;
 
     ImGui_ImplOpenGL3_NewFrame();
     ImGui_ImplSDL3_NewFrame();
     ImGui::NewFrame();
-    
-    // 2. Show a simple window that we create ourselves. We use a Begin/End pair to create a named window.
-    {
-        static float f = 0.0f;
-        static int counter = 0;
-
-        ImGui::Begin("Hello, world!");                          // Create a window called "Hello, world!" and append into it.
-
-        ImGui::Text("This is some useful text.");               // Display some text (you can use a format strings too)
-        ImGui::Checkbox("Demo Window", &show_demo_window);      // Edit bools storing our window open/close state
-        ImGui::Checkbox("Another Window", &show_another_window);
-        ImGui::Checkbox("Register Info", &show_another_window);
-
-        ImGui::SliderFloat("float", &f, 0.0f, 1.0f);            // Edit 1 float using a slider from 0.0f to 1.0f
-        ImGui::ColorEdit3("clear color", (float*)&clear_color); // Edit 3 floats representing a color
-
-        if (ImGui::Button("Button"))                            // Buttons return true when clicked (most widgets return true when edited/activated)
-            counter++;
-        ImGui::SameLine();
-        ImGui::Text("counter = %d", counter);
-
-        ImGuiIO& io = ImGui::GetIO(); (void)io;
-        ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
-        ImGui::End();
-    }
-
-    // 3. Show another simple window.
-    if (show_another_window)
-    {
-        ImGui::Begin("Another Window", &show_another_window);   // Pass a pointer to our bool variable (the window will have a closing button that will clear the bool when clicked)
-        ImGui::Text("Hello from another window!");
-        if (ImGui::Button("Close Me"))
-            show_another_window = false;
-        ImGui::End();
-    }
 
     if (show_register_info)
     {
-        static GBCPU cpu;
         ImGui::Begin("Register Info", &show_register_info);
         ImGui::Text("R16");
+        ImGui::Text("AF %04X  BC %04X", shown.af, shown.bc);
+        ImGui::Text("DE %04X  HL %04X", shown.de, shown.hl);
+        ImGui::Text("SP %04X  PC %04X", shown.sp, shown.pc);
+        ImGui::Text("Rewind %.1f s, %zu KB%s", shown.rewindSeconds, shown.rewindBytes / 1024,
+                    shown.rewinding ? " (rewinding)" : "");
+        ImGui::Text("Hold %s to rewind", SDL_GetScancodeName(REWIND_KEY));
+        if (ImGui::SliderInt("Run-ahead", &runAheadFrames, 0, MAX_RUN_AHEAD)) {
+            runAheadSetting.store(runAheadFrames, std::memory_order_relaxed);
+        }
+        if (runAheadFrames) {
+            ImGui::Text("+%.0f us per frame (%.1fx)", shown.runAheadExtra,
+                        shown.runAheadFrame ? shown.runAheadExtra / shown.runAheadFrame : 0.0);
+        }
+        ImGui::Checkbox("Frame Timing", &show_frame_timing);
         if (ImGui::Button("Close Me"))
             show_register_info = false;
         ImGui::End();
     }
 
+    if (show_frame_timing)
+    {
+        ImGui::Begin("Frame Timing", &show_frame_timing);
+        ImGuiIO& io = ImGui::GetIO();
+        ImGui::Text("%.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
+        ImGui::Text("Emulation %.0f us, %llu frames, %llu never shown, %llu shown twice", shown.emulateMicros,
+                    (unsigned long long)presented.publishedCount(), (unsigned long long)presented.skippedCount(),
+                    (unsigned long long)framesRepeated);
+        ImGui::Text("Upload %.1f us CPU, %.1f us GPU (%s)", screen.uploadMicros(), screen.uploadGpuMicros(),
+                    screen.persistent() ? "persistent" : "orphaned");
+        ImGui::Text("Draw %.1f us at %dx", screen.drawMicros(), screen.scale());
+        ImGui::SeparatorText("Audio");
+        if (ImGui::Checkbox("Dynamic rate control", &rateControlShown)) {
+            rateControl.store(rateControlShown, std::memory_order_relaxed);
+        }
+        if (ImGui::SliderInt("Target ms", &targetLatencyMs, 20, 150)) {
+            audioTarget.store(size_t(GBAPU::SAMPLE_RATE) * targetLatencyMs / 1000, std::memory_order_relaxed);
+        }
+        ImGui::Text("%.1f ms queued, ratio %.5f (%+.3f%%)", audioRing.available() * 1000.0 / GBAPU::SAMPLE_RATE,
+                    shown.resampleRatio, (shown.resampleRatio - 1) * 100);
+        ImGui::Text("%llu underruns, %llu samples dropped",
+                    (unsigned long long)audioUnderruns.load(std::memory_order_relaxed),
+                    (unsigned long long)shown.samplesDropped);
+        ImGui::PlotLines("Frame us", frameTimes, TIMING_FRAMES, timingAt, nullptr, 0.0f, 33333.0f, ImVec2(0, 60));
+        ImGui::PlotLines("Upload us", uploadTimes, TIMING_FRAMES, timingAt, nullptr, 0.0f, 100.0f, ImVec2(0, 60));
+        ImGui::PlotLines("Queue ms", audioLevels, TIMING_FRAMES, timingAt, nullptr, 0.0f, 170.0f, ImVec2(0, 60));
+        ImGui::PlotLines("Ratio %", audioRatios, TIMING_FRAMES, timingAt, nullptr,
+                         float(-RateControl::MAX_DEVIATION * 100), float(RateControl::MAX_DEVIATION * 100),
+                         ImVec2(0, 60));
+        ImGui::End();
+    }
+
     // Rendering
     ImGui::Render();
-    ImGuiIO& io = ImGui::GetIO(); (void)io;
-    glViewport(0, 0, (int)io.DisplaySize.x, (int)io.DisplaySize.y);
-    glClearColor(clear_color.x * clear_color.w, clear_color.y * clear_color.w, clear_color.z * clear_color.w, clear_color.w);
+    int width = 0, height = 0;
+    SDL_GetWindowSizeInPixels(window, &width, &height);
+    glViewport(0, 0, width, height);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
+    if (romLoaded) screen.draw(width, height);
     ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
     SDL_GL_SwapWindow(window);
 
@@ -189,6 +414,10 @@ SDL_AppResult SDL_AppIterate(void *)
 void SDL_AppQuit(void *, SDL_AppResult)
 {
     /* SDL will clean up the window/renderer for us. */
+    emulating = false;
+    if (emulation.joinable()) emulation.join();
+    if (audioStream) SDL_DestroyAudioStream(audioStream);
+    screen.shutdown();
     ImGui_ImplOpenGL3_Shutdown();
     ImGui_ImplSDL3_Shutdown();
     ImGui::DestroyContext();
@@ -0,0 +1,277 @@
+#include <memory/Cartridge.h>
+#include <utils/log.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GB_MMAP 1
+#else
+#define GB_MMAP 0
+#endif
+
+constexpr const char *LOG_TAG = "GBCART";
+
+CartRAM &CartRAM::operator=(const CartRAM &other) {
+    if (this == &other) return *this;
+    release();
+    owned.assign(other.bytes, other.bytes + other.length);
+    bytes = owned.data();
+    length = owned.size();
+    return *this;
+}
+
+CartRAM::~CartRAM() {
+    release();
+}
+
+void CartRAM::release() {
+    if (persisted()) flush(true);
+#if GB_MMAP
+    if (mapping) munmap(mapping, length);
+#endif
+    mapping = nullptr;
+    path.clear();
+    dirtyBegin = dirtyEnd = 0;
+}
+
+void CartRAM::reset(size_t size) {
+    release();
+    owned.assign(size, 0);
+    bytes = owned.data();
+    length = size;
+}
+
+bool CartRAM::persist(const char *file) {
+    if (!length) return false;
+#if GB_MMAP
+    int fd = ::open(file, O_RDWR | O_CREAT, 0644);
+    struct stat info;
+    if (fd < 0 || fstat(fd, &info) != 0 || ftruncate(fd, off_t(length)) != 0) {
+        LOG_E(LOG_TAG, "Could not open save file %s", file);
+        if (fd >= 0) ::close(fd);
+        return false;
+    }
+    void *mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        LOG_E(LOG_TAG, "Could not map save file %s", file);
+        return false;
+    }
+    size_t existing = std::min(size_t(info.st_size), length);
+    uint8_t *saved = static_cast<uint8_t*>(mapped);
+    std::memcpy(saved + existing, bytes + existing, length - existing);
+    release();
+    mapping = mapped;
+    bytes = saved;
+    owned = {};
+    if (existing < length) written(existing, length - existing);
+#else
+    std::vector<uint8_t> contents(bytes, bytes + length);
+    size_t existing = 0;
+    if (std::FILE *in = std::fopen(file, "rb")) {
+        existing = std::fread(contents.data(), 1, length, in);
+        std::fclose(in);
+    }
+    release();
+    owned = std::move(contents);
+    bytes = owned.data();
+    if (existing < length) written(0, length);
+#endif
+    path = file;
+    return true;
+}
+
+void CartRAM::flush(bool wait) {
+    if (!persisted() || !dirty()) return;
+#if GB_MMAP
+    // msync wants page aligned addresses.
+    size_t page = size_t(sysconf(_SC_PAGESIZE));
+    size_t begin = dirtyBegin / page * page;
+    if (msync(bytes + begin, dirtyEnd - begin, wait ? MS_SYNC : MS_ASYNC) != 0) {
+        LOG_E(LOG_TAG, "Could not flush save file %s", path.c_str());
+        return;
+    }
+#else
+    // Without a mapping the file is only as current as the last flush.
+    (void)wait;
+    std::FILE *out = std::fopen(path.c_str(), "wb");
+    if (!out || std::fwrite(bytes, 1, length, out) != length) {
+        LOG_E(LOG_TAG, "Could not write save file %s", path.c_str());
+        if (out) std::fclose(out);
+        return;
+    }
+    std::fclose(out);
+#endif
+    dirtyBegin = dirtyEnd = 0;
+}
+
+bool Cartridge::insert(RomImage::Handle romImage) {
+    if (!romImage) return false;
+    image = std::move(romImage);
+    rom = image->data();
+    romBanks = uint32_t(image->banks());
+
+    std::memcpy(header.title, rom + 0x134, 16);
+    header.title[16] = '\0';
+    for (char &ch: header.title) {
+        if (ch && (ch < 0x20 || ch > 0x7E)) ch = '?';
+    }
+    header.type = rom[0x147];
+    uint8_t checksum = 0;
+    for (unsigned at = 0x134; at <= 0x14C; ++at) checksum = checksum - rom[at] - 1;
+    header.checksumOK = checksum == rom[0x14D];
+
+    switch (header.type) {
+        case 0x03: case 0x06: case 0x09: case 0x0D: case 0x0F: case 0x10: case 0x13:
+        case 0x1B: case 0x1E: case 0x22: case 0xFF:
+            header.battery = true;
+            break;
+        default:
+            header.battery = false;
+            break;
+    }
+    switch (header.type) {
+        case 0x00: case 0x08: case 0x09: type = MBC::None; break;
+        case 0x01: case 0x02: case 0x03: type = MBC::MBC1; break;
+        case 0x0F: case 0x10: case 0x11: case 0x12: case 0x13: type = MBC::MBC3; break;
+        case 0x19: case 0x1A: case 0x1B: case 0x1C: case 0x1D: case 0x1E: type = MBC::MBC5; break;
+        default:
+            LOG_E(LOG_TAG, "Unsupported cartridge type %02X, running as ROM only", header.type);
+            type = MBC::None;
+            break;
+    }
+
+    static constexpr size_t ramSizes[] = {0, 0x800, 0x2000, 0x8000, 0x20000, 0x10000};
+    uint8_t ramCode = rom[0x149];
+    size_t ramBytes = ramCode < std::size(ramSizes) ? ramSizes[ramCode] : 0;
+    // Partial banks are still addressed as a whole 8 KB window.
+    ram.reset(ramBytes ? std::max(ramBytes, RAM_BANK_SIZE) : 0);
+
+    ramEnabled = false;
+    bankLow = 1;
+    bankHigh = ramSelect = 0;
+    mbc1Mode = false;
+    rtc = {};
+    updateBanks();
+
+    static constexpr const char *mbcNames[] = {"ROM only", "MBC1", "MBC3", "MBC5"};
+    LOG_I(LOG_TAG, "Inserted %s: \"%s\", %s, %u KB ROM, %zu KB RAM%s%s%s", image->name(), header.title,
+          mbcNames[int(type)], unsigned(romSize() / 1024), ram.size() / 1024, header.battery ? " (battery)" : "",
+          image->mapped() ? "" : ", copied", header.checksumOK ? "" : ", bad header checksum");
+    return true;
+}
+
+bool Cartridge::attachSave(const char *path) {
+    if (!header.battery || !ram.size()) {
+        LOG_E(LOG_TAG, "%s has no battery backed RAM to save", image ? image->name() : "No cartridge");
+        return false;
+    }
+    if (!ram.persist(path)) return false;
+    LOG_I(LOG_TAG, "Saving RAM to %s", path);
+    return true;
+}
+
+void Cartridge::saveState(State &state) const {
+    state = {romBanks, uint16_t(rom[0x14E] << 8 | rom[0x14F]), header.type, rom[0x14D],
+             ramEnabled, bankLow, bankHigh, ramSelect, mbc1Mode, rtc, {}};
+}
+
+bool Cartridge::matches(const State &state) const {
+    return loaded() && state.romBanks == romBanks && state.type == header.type &&
+           state.headerChecksum == rom[0x14D] && state.globalChecksum == (rom[0x14E] << 8 | rom[0x14F]);
+}
+
+void Cartridge::loadState(const State &state) {
+    ramEnabled = state.ramEnabled;
+    bankLow = state.bankLow;
+    bankHigh = state.bankHigh;
+    ramSelect = state.ramSelect;
+    mbc1Mode = state.mbc1Mode;
+    rtc = state.rtc;
+    updateBanks();
+}
+
+void Cartridge::loadRAM(const uint8_t *data) {
+    if (!ram.size()) return;
+    std::memcpy(ram.data(), data, ram.size());
+    ram.written(0, ram.size());
+}
+
+bool Cartridge::writeRegister(uint16_t address, uint8_t data) {
+    if (type == MBC::None) return false;
+    std::array<uint16_t, 2> oldRom = romBank;
+    uint16_t oldRam = ramBankNumber;
+    bool oldMapped = ramMapped;
+
+    switch (address >> 13) {
+        case 0:
+            ramEnabled = (data & 0x0F) == 0x0A;
+            break;
+        case 1:
+            if (type == MBC::MBC1) bankLow = data & 0x1F;
+            else if (type == MBC::MBC3) bankLow = data & 0x7F;
+            else if (address < 0x3000) bankLow = data;
+            else bankHigh = data & 0x01;
+            break;
+        case 2:
+            if (type == MBC::MBC1) bankHigh = data & 0x03;
+            else ramSelect = data & 0x0F;
+            break;
+        case 3:
+            // MBC3 latches the clock here, a no-op while it does not run.
+            if (type == MBC::MBC1) mbc1Mode = data & 0x01;
+            break;
+    }
+    updateBanks();
+    return romBank != oldRom || ramBankNumber != oldRam || ramMapped != oldMapped;
+}
+
+void Cartridge::updateBanks() {
+    uint32_t ramBanks = uint32_t(ram.size() / RAM_BANK_SIZE);
+    uint32_t low = 0, high = 1, ramIndex = 0;
+    bool rtcSelected = false;
+    switch (type) {
+        case MBC::None:
+            break;
+        case MBC::MBC1:
+            // Bank 0 in the low five bits selects 1, also for 20/40/60.
+            high = (uint32_t(bankHigh) << 5) | (bankLow ? bankLow : 1);
+            if (mbc1Mode) {
+                low = uint32_t(bankHigh) << 5;
+                ramIndex = bankHigh;
+            }
+            break;
+        case MBC::MBC3:
+            high = bankLow ? bankLow : 1;
+            ramIndex = ramSelect & 0x03;
+            rtcSelected = ramSelect >= 0x08;
+            break;
+        case MBC::MBC5:
+            high = (uint32_t(bankHigh) << 8) | bankLow;
+            ramIndex = ramSelect;
+            break;
+    }
+    romBank = {uint16_t(low % romBanks), uint16_t(high % romBanks)};
+    ramBankNumber = ramBanks ? uint16_t(ramIndex % ramBanks) : 0;
+    // ROM+RAM carts have no enable register; their RAM is always there.
+    ramMapped = ramBanks && (ramEnabled || type == MBC::None) && !rtcSelected;
+}
+
+uint8_t Cartridge::readRAM(uint16_t) const {
+    if (type == MBC::MBC3 && ramEnabled && ramSelect >= 0x08 && ramSelect <= 0x0C) {
+        return rtc[ramSelect - 0x08];
+    }
+    // Only reachable while the window is unmapped: open bus.
+    return 0xFF;
+}
+
+void Cartridge::writeRAM(uint16_t, uint8_t data) {
+    if (type == MBC::MBC3 && ramEnabled && ramSelect >= 0x08 && ramSelect <= 0x0C) {
+        rtc[ramSelect - 0x08] = data;
+    }
+}
@@ -0,0 +1,679 @@
+#include <memory/GBMemory.h>
+#include <utils/log.h>
+#include <algorithm>
+
+constexpr const char *LOG_TAG = "GBMEM";
+
+// The footprint in the GBMEM comment: 16 KB of VRAM and WRAM, 0.5 KB of
+// OAM, I/O and HRAM, 6 KB of page tables and 9 KB of region handlers make
+// 31.5 KB; the cartridge and bookkeeping take under 1 KB more, and half a
+// KB is slack, 33 KB in all. The ROM must never creep back in.
+static_assert(sizeof(GBMEM) <= (16 + 0.5 + 6 + 9 + 1 + 0.5) * 1024, "GBMEM grew past its documented footprint");
+
+// Bits of FF10-FF2F that read as 1 whatever was written.
+static constexpr uint8_t SOUND_READ_MASK[0x20] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF,   // NR10-NR14
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF,   // NR20-NR24
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF,   // NR30-NR34
+    0xFF, 0xFF, 0x00, 0x00, 0xBF,   // NR40-NR44
+    0x00, 0x00, 0x70,               // NR50-NR52
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+};
+
+static constexpr uint64_t FRAME_CYCLES = GBMEM::CYCLES_PER_LINE * GBMEM::LINES_PER_FRAME;
+static constexpr uint64_t VBLANK_CYCLE = GBMEM::CYCLES_PER_LINE * GBMEM::VISIBLE_LINES;
+// STAT interrupt sources.
+static constexpr uint8_t STAT_HBLANK = 0x08, STAT_VBLANK = 0x10, STAT_OAM = 0x20, STAT_LYC = 0x40;
+// T-states per TIMA increment for each TAC clock select. TIMA counts
+// falling edges of the divider bit half that far up.
+static constexpr uint64_t TIMER_PERIODS[4] = {1024, 16, 64, 256};
+static constexpr uint8_t TIMER_ON = 0x04;
+// Eight bits at 8192 Hz on the internal clock.
+static constexpr uint64_t SERIAL_CYCLES = 8 * 128;
+static constexpr uint64_t DMA_CYCLES = 160;
+
+GBMEM::GBMEM() {
+    // Sound as the boot ROM leaves it: powered, every channel silent, both
+    // outputs at full volume.
+    io[0x12] = 0xF3;
+    io[0x24] = 0x77;
+    io[0x25] = 0xF3;
+    io[0x26] = 0x80;
+    // And the rest: VBlank requested, the divider part way along.
+    io[0x0F] = VBLANK;
+    divider = 0xABCC;
+    remap();
+}
+
+GBMEM::GBMEM(const GBMEM &other) {
+    *this = other;
+}
+
+GBMEM &GBMEM::operator=(const GBMEM &other) {
+    if (this == &other) return *this;
+    cart = other.cart;
+    vram = other.vram;
+    wram = other.wram;
+    oam = other.oam;
+    io = other.io;
+    hram = other.hram;
+    buttons = other.buttons;
+    pending = other.pending;
+    events = other.events;
+    eventsRun = other.eventsRun;
+    divider = other.divider;
+    timerSynced = other.timerSynced;
+    regions = other.regions;
+    ioRegions = other.ioRegions;
+    codePages = other.codePages;
+    staleCode = other.staleCode;
+    codeWrites = other.codeWrites;
+    changedSprites = ALL_SPRITES;
+    recordingSound = false;
+    soundWrites.clear();
+    banks = other.banks;
+    bank0Generation = other.bank0Generation;
+    // Copies never write the save file, so they have nothing to track.
+    saveClean.reset();
+    deltaBase = other.deltaBase;
+    pagesWritten = other.pagesWritten;
+    deltaClean = other.deltaClean;
+    remap();
+    return *this;
+}
+
+void GBMEM::remap(unsigned first, unsigned last) {
+    for (unsigned page = first; page <= last; ++page) {
+        // ROM is only ever read, so its window is const.
+        uint8_t *backing = nullptr;
+        const uint8_t *romBacking = nullptr;
+        if (page < 0x80) {
+            if (cart.loaded()) romBacking = cart.romWindow(page >> 6) + ((page & 0x3F) << 8);
+        } else if (page < 0xA0) {
+            backing = vram.data() + ((page - 0x80) << 8);
+        } else if (page < 0xC0) {
+            if (uint8_t *window = cart.ramWindow()) backing = window + ((page - 0xA0) << 8);
+        } else if (page < 0xE0) {
+            backing = wram.data() + ((page - 0xC0) << 8);
+        } else if (page < 0xFE) {
+            backing = wram.data() + ((page - 0xE0) << 8);
+        } else if (page == 0xFE) {
+            backing = oam.data();
+        }
+
+        const Region &region = regions[page];
+        readPages[page] = region.read ? nullptr : (page < 0x80 ? romBacking : backing);
+        memPages[page] = region.write ? nullptr : backing;
+        writePages[page] = trapsWrites(page) ? nullptr : memPages[page];
+    }
+}
+
+void GBMEM::remapCartridge() {
+    uint16_t bank0 = cart.romBankAt(0), bank1 = cart.romBankAt(1);
+    if (bank0 != banks[0]) ++bank0Generation;
+    // Code from the old bank may be part way through a predecoded block;
+    // counting the switch as a code write ends that block after the store.
+    if (bank0 != banks[0] || bank1 != banks[2]) ++codeWrites;
+    banks[0] = banks[1] = bank0;
+    banks[2] = banks[3] = bank1;
+    // Pages left untracked were dirtied in the old RAM bank, not this one.
+    if (cart.ramBank() != banks[5] && cart.hasSave()) saveClean.set();
+    banks[5] = cart.ramBank();
+    remap(0x00, 0x7F);
+    // Also rearms the RAM window for whatever bank is in it now.
+    armDelta(0xA0, 0xBF);
+}
+
+bool GBMEM::attachSave(const char *path) {
+    if (!cart.attachSave(path)) return false;
+    saveClean.set();
+    remap(0xA0, 0xBF);
+    return true;
+}
+
+void GBMEM::flushSave(bool wait) {
+    if (!cart.saveDirty()) return;
+    cart.flushSave(wait);
+    saveClean.set();
+    remap(0xA0, 0xBF);
+}
+
+void GBMEM::saveWritten(uint8_t page, uint16_t address) {
+    cart.ramWritten(address);
+    saveClean.reset(page - 0xA0);
+    writePages[page] = trapsWrites(page) ? nullptr : memPages[page];
+}
+
+int GBMEM::statePageOf(unsigned page) const {
+    if (page < 0x80 || page == 0xFF) return -1;
+    if (page < 0xA0) return page - 0x80;
+    if (page < 0xC0) return cart.ramSize() ? int(0x41 + banks[5] * 0x20 + (page - 0xA0)) : -1;
+    if (page < 0xE0) return 0x20 + (page - 0xC0);
+    if (page < 0xFE) return 0x20 + (page - 0xE0);
+    return 0x40;
+}
+
+const uint8_t *GBMEM::statePage(size_t index) const {
+    if (index < 0x20) return vram.data() + index * STATE_PAGE_SIZE;
+    if (index < 0x40) return wram.data() + (index - 0x20) * STATE_PAGE_SIZE;
+    if (index == 0x40) return oam.data();
+    return cart.ramData() + (index - 0x41) * STATE_PAGE_SIZE;
+}
+
+void GBMEM::armDelta(unsigned first, unsigned last) {
+    for (unsigned page = first; page <= last; ++page) {
+        int index = statePageOf(page);
+        deltaClean[page] = deltaBase && index >= 0 && !pagesWritten[index];
+    }
+    remap(first, last);
+}
+
+void GBMEM::trackWrites(uint64_t base) {
+    deltaBase = base;
+    pagesWritten.reset();
+    armDelta(0x80, 0xFE);
+}
+
+void GBMEM::deltaWritten(uint8_t page) {
+    pagesWritten.set(statePageOf(page));
+    for (int marked: {int(page), echoOf(page)}) {
+        if (marked < 0) continue;
+        deltaClean.reset(marked);
+        writePages[marked] = trapsWrites(marked) ? nullptr : memPages[marked];
+    }
+}
+
+void GBMEM::saveDelta(DeltaState &state, uint16_t *indices, uint8_t *pages) const {
+    state.io = io;
+    state.hram = hram;
+    cart.saveState(state.cart);
+    saveTiming(state.timing);
+    size_t count = statePages();
+    for (size_t index = 0; index < count; ++index) {
+        if (!pagesWritten[index]) continue;
+        *indices++ = uint16_t(index);
+        std::memcpy(pages, statePage(index), STATE_PAGE_SIZE);
+        pages += STATE_PAGE_SIZE;
+    }
+}
+
+bool GBMEM::loadDelta(const DeltaState &state, const uint16_t *indices, const uint8_t *pages, size_t count) {
+    if (!cart.matches(state.cart)) return false;
+    for (size_t i = 0; i < count; ++i) {
+        if (indices[i] >= statePages()) return false;
+    }
+    io = state.io;
+    hram = state.hram;
+    cart.loadState(state.cart);
+    loadTiming(state.timing);
+    pagesWritten.reset();
+    for (size_t i = 0; i < count; ++i, pages += STATE_PAGE_SIZE) {
+        size_t index = indices[i];
+        pagesWritten.set(index);
+        if (index >= 0x41) {
+            cart.restoreRAM((index - 0x41) * STATE_PAGE_SIZE, pages, STATE_PAGE_SIZE);
+            continue;
+        }
+        uint8_t *target = index < 0x20 ? vram.data() + index * STATE_PAGE_SIZE
+                        : index < 0x40 ? wram.data() + (index - 0x20) * STATE_PAGE_SIZE
+                        : oam.data();
+        std::memcpy(target, pages, STATE_PAGE_SIZE);
+    }
+    remapCartridge();
+    armDelta(0x80, 0xFE);
+    changedSprites = ALL_SPRITES;
+    soundWrites.clear();
+    for (unsigned page = 0x80; page <= 0xFF; ++page) {
+        if (codePages[page]) codeWritten(uint8_t(page));
+    }
+    return true;
+}
+
+void GBMEM::saveState(State &state, uint8_t *ram) const {
+    state.vram = vram;
+    state.wram = wram;
+    state.oam = oam;
+    state.io = io;
+    state.hram = hram;
+    cart.saveState(state.cart);
+    saveTiming(state.timing);
+    if (cart.ramSize()) std::memcpy(ram, cart.ramData(), cart.ramSize());
+}
+
+bool GBMEM::loadState(const State &state, const uint8_t *ram) {
+    if (!cart.matches(state.cart)) return false;
+    vram = state.vram;
+    wram = state.wram;
+    oam = state.oam;
+    io = state.io;
+    hram = state.hram;
+    cart.loadState(state.cart);
+    cart.loadRAM(ram);
+    loadTiming(state.timing);
+    remapCartridge();
+    // Against the tracked base, everything may have changed.
+    pagesWritten.set();
+    armDelta(0x80, 0xFE);
+    changedSprites = ALL_SPRITES;
+    soundWrites.clear();
+    for (unsigned page = 0x80; page <= 0xFF; ++page) {
+        if (codePages[page]) codeWritten(uint8_t(page));
+    }
+    return true;
+}
+
+void GBMEM::saveTiming(TimingState &state) const {
+    state.divider = divider;
+    state.timerSynced = timerSynced;
+    for (unsigned event = 0; event < state.events.size(); ++event) state.events[event] = events.dueAt(event);
+}
+
+void GBMEM::loadTiming(const TimingState &state) {
+    divider = state.divider;
+    timerSynced = state.timerSynced;
+    events.clear();
+    for (unsigned event = 0; event < state.events.size(); ++event) events.schedule(event, state.events[event]);
+    pending = io[0x0F] & hram[0x7F] & 0x1F;
+}
+
+void GBMEM::mapRegion(uint8_t first, uint8_t last, ReadHandler read, WriteHandler write, void *context) {
+    for (unsigned page = first; page <= last; ++page) {
+        if (read) regions[page].read = read;
+        if (write) regions[page].write = write;
+        regions[page].context = context;
+    }
+    remap();
+}
+
+void GBMEM::mapIO(uint16_t address, ReadHandler read, WriteHandler write, void *context) {
+    Region &region = ioRegions[address & 0x7F];
+    if (read) region.read = read;
+    if (write) region.write = write;
+    region.context = context;
+}
+
+uint8_t GBMEM::readSlow(uint16_t address) const {
+    uint8_t page = address >> 8;
+    if (page == 0xFF) return readHigh(address);
+    const Region &region = regions[page];
+    if (region.read) return region.read(region.context, address);
+    if (isCartRAM(page)) return cart.readRAM(address);
+    return 0xFF;
+}
+
+void GBMEM::storeSlow(uint16_t address, uint8_t data) {
+    uint8_t page = address >> 8;
+    if (page == 0xFF) {
+        storeHigh(address, data);
+        return;
+    }
+    const Region &region = regions[page];
+    if (uint8_t *backing = memPages[page]) {
+        backing[address & 0xFF] = data;
+        if (isCartRAM(page) && saveClean[page - 0xA0]) saveWritten(page, address);
+        if (deltaClean[page]) deltaWritten(page);
+        if (page == 0xFE && (address & 0xFF) < 4 * SPRITES) {
+            changedSprites |= uint64_t(1) << ((address & 0xFF) / 4);
+        }
+    } else if (region.write) {
+        region.write(region.context, address, data);
+    } else if (page < 0x80) {
+        if (cart.writeRegister(address, data)) remapCartridge();
+        return;
+    } else if (isCartRAM(page)) {
+        cart.writeRAM(address, data);
+    }
+    if (codePages[page]) codeWritten(page);
+}
+
+uint8_t GBMEM::readHigh(uint16_t address) const {
+    if (address >= 0xFF80) return hram[address & 0x7F];
+    const Region &region = ioRegions[address & 0x7F];
+    if (region.read) return region.read(region.context, address);
+    switch (address) {
+        case 0xFF00: return 0xC0 | (io[0] & 0x30) | joypadLines();
+        case 0xFF02: return 0x7E | io[0x02];
+        case 0xFF04: return uint8_t(timerCounter(now()) >> 8);
+        case 0xFF05: return timaAt(now());
+        case 0xFF07: return 0xF8 | io[0x07];
+        case 0xFF0F: return 0xE0 | io[0x0F];
+    }
+    if (address == 0xFF41 || address == 0xFF44) {
+        uint16_t status = lcdStatus();
+        return uint8_t(address == 0xFF44 ? status >> 8 : status);
+    }
+    if (address >= 0xFF10 && address < 0xFF30) return io[address & 0x7F] | SOUND_READ_MASK[address - 0xFF10];
+    return io[address & 0x7F];
+}
+
+// STAT with LY in the high byte.
+uint16_t GBMEM::lcdStatus() const {
+    uint16_t status = 0x80 | (io[0x41] & 0x78);
+    if (!(io[0x40] & 0x80)) return status;
+    uint64_t cycles = now();
+    unsigned line = unsigned(cycles / CYCLES_PER_LINE % LINES_PER_FRAME);
+    uint64_t dot = cycles % CYCLES_PER_LINE;
+    if (line >= VISIBLE_LINES) status |= 1;
+    else if (dot < OAM_SCAN_CYCLES) status |= 2;
+    else if (dot < OAM_SCAN_CYCLES + TRANSFER_CYCLES) status |= 3;
+    if (line == io[0x45]) status |= 0x04;
+    return status | line << 8;
+}
+
+void GBMEM::storeHigh(uint16_t address, uint8_t data) {
+    if (address >= 0xFF80) {
+        hram[address & 0x7F] = data;
+        if (address == 0xFFFF) interruptBitsStored();
+        if (codePages[0xFF]) codeWritten(0xFF);
+        return;
+    }
+    const Region &region = ioRegions[address & 0x7F];
+    if (region.write) {
+        region.write(region.context, address, data);
+        return;
+    }
+    if (address >= 0xFF10 && address < 0xFF40) {
+        storeSound(address, data);
+        return;
+    }
+    switch (address) {
+        case 0xFF02:
+            // Nothing is ever on the other end, so only a transfer on the
+            // internal clock finishes.
+            io[0x02] = data;
+            schedule(SERIAL_EVENT, (data & 0x81) == 0x81 ? now() + SERIAL_CYCLES : NEVER);
+            return;
+        case 0xFF04: case 0xFF05: case 0xFF06: case 0xFF07:
+            storeTimer(address, data);
+            return;
+        case 0xFF0F:
+            io[0x0F] = data & 0x1F;
+            interruptBitsStored();
+            return;
+        case 0xFF40: case 0xFF41: case 0xFF45:
+            storeLCD(address, data);
+            return;
+        case 0xFF46:
+            io[0x46] = data;
+            schedule(DMA_EVENT, now() + DMA_CYCLES);
+            return;
+    }
+    io[address & 0x7F] = data;
+}
+
+// Pressed lines of the groups P1 selects, low for pressed.
+uint8_t GBMEM::joypadLines() const {
+    // A low select bit picks the d-pad (bit 4) or the buttons (bit 5).
+    uint8_t select = io[0] & 0x30;
+    uint8_t lines = 0x0F;
+    if (!(select & 0x10)) lines &= ~buttons & 0x0F;
+    if (!(select & 0x20)) lines &= ~(buttons >> 4) & 0x0F;
+    return lines;
+}
+
+void GBMEM::setButtons(uint8_t pressed) {
+    uint8_t before = joypadLines();
+    buttons = pressed;
+    if (before & ~joypadLines()) requestInterrupt(JOYPAD);
+}
+
+uint64_t GBMEM::steadyUntil(uint16_t address) const {
+    uint64_t time = now();
+    uint8_t page = address >> 8;
+    // Work RAM and HRAM only change when stored to.
+    if (page >= 0xC0 && page < 0xE0) return regions[page].read ? time : NEVER;
+    if (page != 0xFF) return time;
+    if (address >= 0xFF80) return NEVER;
+    if (ioRegions[address & 0x7F].read) return time;
+    // The first cycle at which the T-state counter reaches a multiple of
+    // step.
+    auto counterStep = [&](uint64_t step) {
+        uint64_t counter = timerCounter(time);
+        return time + (step - counter % step + 3) / 4;
+    };
+    bool lcdOn = io[0x40] & 0x80;
+    uint64_t dot = time % CYCLES_PER_LINE;
+    uint64_t nextLine = time - dot + CYCLES_PER_LINE;
+    switch (address) {
+        case 0xFF04: return counterStep(256);
+        case 0xFF05: return io[0x07] & TIMER_ON ? counterStep(TIMER_PERIODS[io[0x07] & 3]) : NEVER;
+        case 0xFF44: return lcdOn ? nextLine : NEVER;
+        case 0xFF41:
+            if (!lcdOn) return NEVER;
+            // The LYC flag moves with the line, the mode within it.
+            if (time / CYCLES_PER_LINE % LINES_PER_FRAME >= VISIBLE_LINES) return nextLine;
+            if (dot < OAM_SCAN_CYCLES) return time - dot + OAM_SCAN_CYCLES;
+            if (dot < OAM_SCAN_CYCLES + TRANSFER_CYCLES) return time - dot + OAM_SCAN_CYCLES + TRANSFER_CYCLES;
+            return nextLine;
+    }
+    return NEVER;
+}
+
+unsigned GBMEM::runEvents() {
+    unsigned ran = 0;
+    unsigned event;
+    uint64_t time;
+    while (events.pop(now(), event, time)) {
+        runEvent(event, time);
+        ++ran;
+    }
+    eventsRun += ran;
+    return ran;
+}
+
+// Native code only stops at the deadline, so an interrupt a store to IE or
+// IF makes pending has to pull it in to be taken where the interpreters
+// take it. Whether IME lets it in is for the CPU to see.
+void GBMEM::interruptBitsStored() {
+    pending = io[0x0F] & hram[0x7F] & 0x1F;
+    if (pending && deadline && now() < *deadline) *deadline = now();
+}
+
+void GBMEM::schedule(Event event, uint64_t time) {
+    events.schedule(event, time);
+    if (deadline && time < *deadline) *deadline = time;
+}
+
+// Each event runs as of the cycle it was due, however far past that the
+// last instruction took the clock.
+void GBMEM::runEvent(unsigned event, uint64_t time) {
+    switch (event) {
+        case LCD_EVENT:
+            if (time % FRAME_CYCLES == VBLANK_CYCLE) requestInterrupt(VBLANK);
+            if (statLine(time) && !statLine(time - 1)) requestInterrupt(LCD_STAT);
+            scheduleLCD(time);
+            break;
+        case TIMER_EVENT:
+            syncTimer(time);
+            scheduleTimer();
+            break;
+        case SERIAL_EVENT:
+            io[0x01] = 0xFF;
+            io[0x02] &= 0x7F;
+            requestInterrupt(SERIAL);
+            break;
+        case DMA_EVENT:
+            dma(io[0x46]);
+            break;
+    }
+}
+
+// The STAT interrupt line: any enabled source holding. The interrupt is
+// requested as it rises, so one source does not retrigger while another
+// keeps it up.
+bool GBMEM::statLine(uint64_t time) const {
+    if (!(io[0x40] & 0x80)) return false;
+    unsigned line = unsigned(time / CYCLES_PER_LINE % LINES_PER_FRAME);
+    uint64_t dot = time % CYCLES_PER_LINE;
+    uint8_t sources = io[0x41];
+    if ((sources & STAT_LYC) && line == io[0x45]) return true;
+    if (line >= VISIBLE_LINES) return sources & STAT_VBLANK;
+    if (dot < OAM_SCAN_CYCLES) return sources & STAT_OAM;
+    return dot >= OAM_SCAN_CYCLES + TRANSFER_CYCLES && (sources & STAT_HBLANK);
+}
+
+// The next point strictly after that can raise an interrupt: VBlank, and
+// where each enabled STAT source starts to hold.
+void GBMEM::scheduleLCD(uint64_t after) {
+    if (!(io[0x40] & 0x80)) {
+        events.cancel(LCD_EVENT);
+        return;
+    }
+    uint64_t frameAt = after % FRAME_CYCLES;
+    auto next = [&](unsigned line, uint64_t dot) {
+        uint64_t point = line * CYCLES_PER_LINE + dot;
+        return after - frameAt + (point > frameAt ? point : FRAME_CYCLES + point);
+    };
+    unsigned line = unsigned(frameAt / CYCLES_PER_LINE);
+    uint64_t dot = frameAt % CYCLES_PER_LINE;
+    auto nextVisible = [&](uint64_t at) {
+        if (line < VISIBLE_LINES && dot < at) return next(line, at);
+        return next(line + 1 < VISIBLE_LINES ? line + 1 : 0, at);
+    };
+    uint8_t sources = io[0x41];
+    uint64_t due = next(VISIBLE_LINES, 0);
+    if (sources & STAT_OAM) due = std::min(due, nextVisible(0));
+    if (sources & STAT_HBLANK) due = std::min(due, nextVisible(OAM_SCAN_CYCLES + TRANSFER_CYCLES));
+    if ((sources & STAT_LYC) && io[0x45] < LINES_PER_FRAME) due = std::min(due, next(io[0x45], 0));
+    schedule(LCD_EVENT, due);
+}
+
+// LCDC, STAT and LYC. A write that raises the STAT line requests the
+// interrupt then and there.
+void GBMEM::storeLCD(uint16_t address, uint8_t data) {
+    uint64_t time = now();
+    bool before = statLine(time);
+    io[address & 0x7F] = data;
+    if (!before && statLine(time)) requestInterrupt(LCD_STAT);
+    scheduleLCD(time);
+}
+
+unsigned GBMEM::timerEdges(uint64_t from, uint64_t to) const {
+    uint64_t period = TIMER_PERIODS[io[0x07] & 3];
+    return unsigned(timerCounter(to) / period - timerCounter(from) / period);
+}
+
+// TIMA as of time, counting on from where it was last synced; overflows
+// reload it from TMA.
+uint8_t GBMEM::timaAt(uint64_t time, unsigned *overflows) const {
+    uint8_t tima = io[0x05];
+    if (!(io[0x07] & TIMER_ON)) return tima;
+    for (unsigned edges = timerEdges(timerSynced, time); edges;) {
+        unsigned room = 256u - tima;
+        if (edges < room) {
+            tima = uint8_t(tima + edges);
+            break;
+        }
+        edges -= room;
+        tima = io[0x06];
+        if (overflows) ++*overflows;
+    }
+    return tima;
+}
+
+void GBMEM::syncTimer(uint64_t time) {
+    unsigned overflows = 0;
+    io[0x05] = timaAt(time, &overflows);
+    timerSynced = time;
+    if (overflows) requestInterrupt(TIMER);
+}
+
+// Due at the edge that takes TIMA past 0xFF. The reload and the interrupt
+// come with the overflow rather than a cycle after it.
+void GBMEM::scheduleTimer() {
+    if (!(io[0x07] & TIMER_ON)) {
+        events.cancel(TIMER_EVENT);
+        return;
+    }
+    uint64_t period = TIMER_PERIODS[io[0x07] & 3];
+    uint64_t counter = timerCounter(timerSynced);
+    uint64_t overflow = (counter / period + (256 - io[0x05])) * period;
+    schedule(TIMER_EVENT, timerSynced + (overflow - counter) / 4);
+}
+
+// TIMA counts falling edges of the divider bit TAC selects, gated by the
+// enable, so resetting the divider or changing TAC while that input is high
+// counts one more, as on hardware.
+void GBMEM::storeTimer(uint16_t address, uint8_t data) {
+    uint64_t time = now();
+    syncTimer(time);
+    auto input = [&](uint8_t tac) { return (tac & TIMER_ON) && (timerCounter(time) & TIMER_PERIODS[tac & 3] / 2); };
+    bool before = input(io[0x07]);
+    switch (address) {
+        case 0xFF04: divider = 0 - 4 * time; break;
+        case 0xFF05: io[0x05] = data; break;
+        case 0xFF06: io[0x06] = data; break;
+        case 0xFF07: io[0x07] = data & 7; break;
+    }
+    if (before && !input(io[0x07]) && ++io[0x05] == 0) {
+        io[0x05] = io[0x06];
+        requestInterrupt(TIMER);
+    }
+    scheduleTimer();
+}
+
+// Channel n (0-3) is triggered through NRn4 and has its DAC in the top
+// five bits of NRn2, or NR30.7 for the wave channel. Wave RAM is always
+// writable.
+void GBMEM::storeSound(uint16_t address, uint8_t data) {
+    unsigned reg = address & 0x7F;
+    uint8_t &status = io[0x26];
+    if (reg == 0x26) {
+        if (!(data & 0x80)) std::fill(io.begin() + 0x10, io.begin() + 0x27, 0);
+        else status |= 0x80;
+    } else if (reg < 0x26 && !(status & 0x80)) {
+        return;
+    } else {
+        io[reg] = data;
+        if (reg < 0x24) {
+            unsigned channel = (reg - 0x10) / 5;
+            bool dac = channel == 2 ? io[0x1A] & 0x80 : io[0x12 + 5 * channel] & 0xF8;
+            if (!dac) status &= ~(1 << channel);
+            else if (reg == 0x14 + 5 * channel && data & 0x80) status |= 1 << channel;
+        }
+    }
+    if (recordingSound) soundWrites.push_back({now(), address, data});
+}
+
+// OAM DMA, copied as the transfer ends.
+void GBMEM::dma(uint8_t source) {
+    for (unsigned i = 0; i < 4 * SPRITES; ++i) oam[i] = read8(uint16_t(source << 8 | i));
+    changedSprites = ALL_SPRITES;
+    if (deltaClean[0xFE]) deltaWritten(0xFE);
+    if (codePages[0xFE]) codeWritten(0xFE);
+}
+
+void GBMEM::markCode(uint8_t page) {
+    if (page < 0x80) return;
+    codePages[page] = 1;
+    writePages[page] = nullptr;
+    int echo = echoOf(page);
+    if (echo >= 0) {
+        codePages[echo] = 1;
+        writePages[echo] = nullptr;
+    }
+}
+
+void GBMEM::codeWritten(uint8_t page) {
+    for (int marked: {int(page), echoOf(page)}) {
+        if (marked < 0) continue;
+        codePages[marked] = 0;
+        writePages[marked] = trapsWrites(marked) ? nullptr : memPages[marked];
+        staleCode.set(marked);
+    }
+    ++codeWrites;
+}
+
+bool GBMEM::insert(RomImage::Handle image) {
+    if (!cart.insert(std::move(image))) return false;
+    remapCartridge();
+    return true;
+}
+
+bool GBMEM::loadROM(const char *path) {
+    return insert(RomImage::open(path));
+}
+
+bool GBMEM::loadROM(const uint8_t *data, size_t size) {
+    return insert(RomImage::copy(data, size));
+}
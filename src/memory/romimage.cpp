@@ -0,0 +1,88 @@
+#include <memory/RomImage.h>
+#include <utils/log.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define GB_MMAP 1
+#else
+#define GB_MMAP 0
+#endif
+
+constexpr const char *LOG_TAG = "GBROM";
+
+RomImage::~RomImage() {
+#if GB_MMAP
+    if (mapping) munmap(mapping, length);
+#endif
+}
+
+// Shorter or ragged images are copied and padded to whole banks so every
+// bank window stays inside the image.
+void RomImage::fill(const uint8_t *from, size_t size) {
+    size_t count = std::max<size_t>(2, (size + BANK_SIZE - 1) / BANK_SIZE);
+    owned.assign(count * BANK_SIZE, 0xFF);
+    std::memcpy(owned.data(), from, size);
+    bytes = owned.data();
+    length = owned.size();
+}
+
+RomImage::Handle RomImage::open(const char *path) {
+    std::shared_ptr<RomImage> image(new RomImage);
+    image->path = path;
+#if GB_MMAP
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_E(LOG_TAG, "Could not open ROM %s", path);
+        return nullptr;
+    }
+    struct stat info;
+    size_t size = fstat(fd, &info) == 0 ? size_t(info.st_size) : 0;
+    void *mapped = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    ::close(fd);
+    if (mapped == MAP_FAILED) {
+        LOG_E(LOG_TAG, "Could not map ROM %s", path);
+        return nullptr;
+    }
+    if (size >= 2 * BANK_SIZE && size % BANK_SIZE == 0) {
+        image->mapping = mapped;
+        image->bytes = static_cast<const uint8_t*>(mapped);
+        image->length = size;
+    } else {
+        image->fill(static_cast<const uint8_t*>(mapped), size);
+        munmap(mapped, size);
+    }
+#else
+    std::FILE *file = std::fopen(path, "rb");
+    if (!file) {
+        LOG_E(LOG_TAG, "Could not open ROM %s", path);
+        return nullptr;
+    }
+    std::vector<uint8_t> contents;
+    uint8_t buffer[4096];
+    size_t read;
+    while ((read = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+        contents.insert(contents.end(), buffer, buffer + read);
+    }
+    std::fclose(file);
+    if (contents.empty()) {
+        LOG_E(LOG_TAG, "Empty ROM %s", path);
+        return nullptr;
+    }
+    image->fill(contents.data(), contents.size());
+#endif
+    return image;
+}
+
+RomImage::Handle RomImage::copy(const uint8_t *data, size_t size, const char *name) {
+    if (!size) return nullptr;
+    std::shared_ptr<RomImage> image(new RomImage);
+    image->path = name;
+    image->fill(data, size);
+    return image;
+}
@@ -0,0 +1,196 @@
+#include <ppu/GBPpu.h>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+// LCDC bits.
+static constexpr uint8_t LCD_ON = 0x80, WINDOW_MAP = 0x40, WINDOW_ON = 0x20, UNSIGNED_TILES = 0x10;
+static constexpr uint8_t BG_MAP = 0x08, TALL_SPRITES = 0x04, SPRITES_ON = 0x02, BG_ON = 0x01;
+// Sprite attribute bits.
+static constexpr uint8_t BEHIND_BG = 0x80, FLIP_Y = 0x40, FLIP_X = 0x20, PALETTE_1 = 0x10;
+
+static_assert(GBCPU::CYCLES_PER_FRAME == GBMEM::CYCLES_PER_LINE * GBMEM::LINES_PER_FRAME);
+
+static constexpr auto reversed = [] {
+    std::array<uint8_t, 256> table{};
+    for (unsigned byte = 0; byte < 256; ++byte) {
+        for (unsigned bit = 0; bit < 8; ++bit) table[byte] |= ((byte >> bit) & 1) << (7 - bit);
+    }
+    return table;
+}();
+
+// Bitplanes of count tiles along one pixel row of a 32x32 tile map,
+// starting at column and wrapping around.
+static void gatherRow(const uint8_t *vram, uint8_t lcdc, unsigned map, unsigned row, unsigned column,
+                      unsigned count, uint8_t *lo, uint8_t *hi) {
+    const uint8_t *tiles = vram + map + (row / 8) * 32;
+    for (unsigned t = 0; t < count; ++t) {
+        uint8_t tile = tiles[(column + t) & 31];
+        unsigned address = (lcdc & UNSIGNED_TILES) ? tile * 16 : 0x1000 + int8_t(tile) * 16;
+        address += (row & 7) * 2;
+        lo[t] = vram[address];
+        hi[t] = vram[address + 1];
+    }
+}
+
+uint64_t GBPPU::run(GBCPU &cpu, GBMEM &mem, uint64_t cycles, GBCPU::Dispatch dispatch, bool draw) {
+    constexpr uint64_t LINE = GBMEM::CYCLES_PER_LINE, TRANSFER = GBMEM::OAM_SCAN_CYCLES;
+    uint64_t start = cpu.cycleCount(), end = start + cycles;
+    uint64_t now = start;
+    while (now < end) {
+        // Lines count from power on; the next transfer strictly after now.
+        uint64_t next = now < TRANSFER ? 0 : (now - TRANSFER) / LINE + 1;
+        cpu.run(mem, std::min(next * LINE + TRANSFER, end) - now, dispatch);
+        uint64_t after = cpu.cycleCount();
+        // A block can run past more than one transfer.
+        for (; draw && next * LINE + TRANSFER <= after; ++next) {
+            unsigned line = unsigned(next % GBMEM::LINES_PER_FRAME);
+            if (line < HEIGHT) drawLine(mem, line);
+        }
+        now = after;
+    }
+    return now - start;
+}
+
+void GBPPU::drawLine(GBMEM &mem, unsigned line) {
+    uint8_t *out = pixels.data() + line * WIDTH;
+    uint8_t lcdc = mem.ioRegister(0xFF40);
+    if (line == 0) windowLine = 0;
+    if (!(lcdc & LCD_ON)) {
+        std::memset(out, 0, WIDTH);
+    } else {
+        // Color indices, kept for sprites that hide behind them.
+        alignas(32) uint8_t background[WIDTH] = {};
+        if (lcdc & BG_ON) {
+            const uint8_t *vram = mem.videoRAM().data();
+            alignas(16) uint8_t lo[ROW_TILES], hi[ROW_TILES];
+            alignas(32) uint8_t decoded[ROW_TILES * 8];
+            uint8_t scrollX = mem.ioRegister(0xFF43);
+            unsigned row = (line + mem.ioRegister(0xFF42)) & 0xFF;
+            gatherRow(vram, lcdc, (lcdc & BG_MAP) ? 0x1C00 : 0x1800, row, scrollX / 8, ROW_TILES, lo, hi);
+            decoder.decode(lo, hi, ROW_TILES, decoded);
+            std::memcpy(background, decoded + (scrollX & 7), WIDTH);
+
+            // WX is the left edge plus 7; below 7 the window starts cut off.
+            int windowX = mem.ioRegister(0xFF4B) - 7;
+            if ((lcdc & WINDOW_ON) && line >= mem.ioRegister(0xFF4A) && windowX < int(WIDTH)) {
+                gatherRow(vram, lcdc, (lcdc & WINDOW_MAP) ? 0x1C00 : 0x1800, windowLine, 0, ROW_TILES, lo, hi);
+                decoder.decode(lo, hi, ROW_TILES, decoded);
+                unsigned left = unsigned(std::max(windowX, 0));
+                std::memcpy(background + left, decoded + (left - windowX), WIDTH - left);
+                ++windowLine;
+            }
+            decoder.shade(background, WIDTH, mem.ioRegister(0xFF47), out);
+        } else {
+            // Blank whatever BGP maps colour 0 to; sprites still see colour 0.
+            std::memset(out, 0, WIDTH);
+        }
+        if (lcdc & SPRITES_ON) {
+            syncSprites(mem);
+            drawSprites(mem, line, background, out);
+        }
+    }
+    if (line == HEIGHT - 1) ++completed;
+}
+
+void GBPPU::syncSprites(GBMEM &mem) {
+    const uint8_t *oam = mem.objectRAM().data();
+    unsigned height = (mem.ioRegister(0xFF40) & TALL_SPRITES) ? 16 : 8;
+    uint64_t changed = mem.takeChangedSprites();
+    if (height != spriteHeight) {
+        // Every sprite changes size, so start over.
+        spriteHeight = height;
+        covering.fill(0);
+        staleLines.set();
+        changed = (uint64_t(1) << GBMEM::SPRITES) - 1;
+    } else {
+        // Only a move changes which lines a sprite is on, or its order.
+        for (uint64_t pending = changed; pending; pending &= pending - 1) {
+            unsigned sprite = unsigned(std::countr_zero(pending));
+            if (oam[4 * sprite] == spriteY[sprite] && oam[4 * sprite + 1] == spriteX[sprite]) {
+                changed &= ~(uint64_t(1) << sprite);
+            }
+        }
+        for (uint64_t pending = changed; pending; pending &= pending - 1) {
+            coverLines(unsigned(std::countr_zero(pending)), false);
+        }
+    }
+    for (; changed; changed &= changed - 1) {
+        unsigned sprite = unsigned(std::countr_zero(changed));
+        spriteY[sprite] = oam[4 * sprite];
+        spriteX[sprite] = oam[4 * sprite + 1];
+        coverLines(sprite, true);
+    }
+}
+
+// Sets or clears sprite on the lines its Y puts it on.
+void GBPPU::coverLines(unsigned sprite, bool covered) {
+    uint64_t bit = uint64_t(1) << sprite;
+    int top = spriteY[sprite] - 16;
+    int bottom = std::min(top + int(spriteHeight), int(HEIGHT));
+    for (int line = std::max(top, 0); line < bottom; ++line) {
+        if (covered) covering[line] |= bit;
+        else covering[line] &= ~bit;
+        staleLines.set(line);
+    }
+}
+
+const GBPPU::LineSprites &GBPPU::spritesOn(unsigned line) {
+    LineSprites &list = lines[line];
+    if (!staleLines[line]) return list;
+    staleLines.reset(line);
+    // The first ten in OAM, then by X with OAM order between equals.
+    list.count = 0;
+    for (uint64_t on = covering[line]; on && list.count < MAX_SPRITES_PER_LINE; on &= on - 1) {
+        uint8_t sprite = uint8_t(std::countr_zero(on));
+        unsigned at = list.count++;
+        for (; at && spriteX[list.sprites[at - 1]] > spriteX[sprite]; --at) list.sprites[at] = list.sprites[at - 1];
+        list.sprites[at] = sprite;
+    }
+    return list;
+}
+
+void GBPPU::drawSprites(const GBMEM &mem, unsigned line, const uint8_t *background, uint8_t *out) {
+    const uint8_t *oam = mem.objectRAM().data();
+    const uint8_t *vram = mem.videoRAM().data();
+    unsigned height = spriteHeight;
+    const LineSprites &list = spritesOn(line);
+    const uint8_t *found = list.sprites;
+    unsigned count = list.count;
+    if (!count) return;
+
+    // Padded to a whole vector of tiles.
+    constexpr unsigned SLOTS = (MAX_SPRITES_PER_LINE + 7) & ~7u;
+    alignas(16) uint8_t lo[SLOTS] = {}, hi[SLOTS] = {};
+    for (unsigned s = 0; s < count; ++s) {
+        const uint8_t *entry = oam + 4 * found[s];
+        unsigned row = line + 16 - entry[0];
+        if (entry[3] & FLIP_Y) row = height - 1 - row;
+        // Tall sprites run on into the next tile.
+        unsigned address = (height == 16 ? entry[2] & 0xFE : entry[2]) * 16 + row * 2;
+        lo[s] = vram[address];
+        hi[s] = vram[address + 1];
+        if (entry[3] & FLIP_X) {
+            lo[s] = reversed[lo[s]];
+            hi[s] = reversed[hi[s]];
+        }
+    }
+    alignas(32) uint8_t indices[SLOTS * 8], shades[2][SLOTS * 8];
+    decoder.decode(lo, hi, SLOTS, indices);
+    decoder.shade(indices, SLOTS * 8, mem.ioRegister(0xFF48), shades[0]);
+    decoder.shade(indices, SLOTS * 8, mem.ioRegister(0xFF49), shades[1]);
+
+    // A pixel belongs to the first sprite with a color there, even when
+    // that sprite is then hidden behind the background.
+    bool claimed[WIDTH] = {};
+    for (unsigned s = 0; s < count; ++s) {
+        const uint8_t *entry = oam + 4 * found[s];
+        const uint8_t *shade = shades[(entry[3] & PALETTE_1) ? 1 : 0] + 8 * s;
+        for (unsigned pixel = 0; pixel < 8; ++pixel) {
+            unsigned x = entry[1] + pixel - 8;
+            if (x >= WIDTH || !indices[8 * s + pixel] || claimed[x]) continue;
+            claimed[x] = true;
+            if (!(entry[3] & BEHIND_BG) || !background[x]) out[x] = shade[pixel];
+        }
+    }
+}
@@ -0,0 +1,196 @@
+#include <ppu/TileDecoder.h>
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <vector>
+
+#if GB_TILE_SIMD_X86
+#include <immintrin.h>
+#endif
+
+// Byte i of spread[b] in memory is bit 7-i of b, so a row decodes with two
+// lookups and an OR.
+static constexpr auto spread = [] {
+    std::array<uint64_t, 256> table{};
+    for (unsigned byte = 0; byte < 256; ++byte) {
+        for (unsigned pixel = 0; pixel < 8; ++pixel) {
+            unsigned shift = std::endian::native == std::endian::little ? 8 * pixel : 8 * (7 - pixel);
+            table[byte] |= uint64_t((byte >> (7 - pixel)) & 1) << shift;
+        }
+    }
+    return table;
+}();
+
+static void decodeScalar(const uint8_t *lo, const uint8_t *hi, size_t tiles, uint8_t *out) {
+    for (size_t t = 0; t < tiles; ++t) {
+        uint64_t row = spread[lo[t]] | spread[hi[t]] << 1;
+        std::memcpy(out + 8 * t, &row, sizeof(row));
+    }
+}
+
+static void shadeScalar(const uint8_t *indices, size_t count, uint8_t palette, uint8_t *out) {
+    const uint8_t shades[4] = {uint8_t(palette & 3), uint8_t(palette >> 2 & 3), uint8_t(palette >> 4 & 3),
+                               uint8_t(palette >> 6)};
+    for (size_t i = 0; i < count; ++i) out[i] = shades[indices[i] & 3];
+}
+
+#if GB_TILE_SIMD_X86
+// Each tile's bitplane bytes are broadcast over its 8 pixels, ANDed with
+// that pixel's bit and compared back, which leaves 0xFF where it is set.
+
+__attribute__((target("ssse3")))
+static void decodeSSSE3(const uint8_t *lo, const uint8_t *hi, size_t tiles, uint8_t *out) {
+    const __m128i bits = _mm_set_epi8(1, 2, 4, 8, 16, 32, 64, -128, 1, 2, 4, 8, 16, 32, 64, -128);
+    const __m128i one = _mm_set1_epi8(1), two = _mm_set1_epi8(2);
+    size_t t = 0;
+    for (; t + 8 <= tiles; t += 8) {
+        __m128i l = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(lo + t));
+        __m128i h = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(hi + t));
+        for (int pair = 0; pair < 4; ++pair) {
+            // Tiles 2 * pair and 2 * pair + 1.
+            const __m128i select = _mm_add_epi8(_mm_set_epi8(1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0),
+                                                _mm_set1_epi8(char(2 * pair)));
+            __m128i lset = _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(l, select), bits), bits);
+            __m128i hset = _mm_cmpeq_epi8(_mm_and_si128(_mm_shuffle_epi8(h, select), bits), bits);
+            __m128i index = _mm_or_si128(_mm_and_si128(lset, one), _mm_and_si128(hset, two));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8 * t + 16 * pair), index);
+        }
+    }
+    decodeScalar(lo + t, hi + t, tiles - t, out + 8 * t);
+}
+
+__attribute__((target("ssse3")))
+static void shadeSSSE3(const uint8_t *indices, size_t count, uint8_t palette, uint8_t *out) {
+    uint32_t shades = (palette & 3) | (palette >> 2 & 3) << 8 | (palette >> 4 & 3) << 16 | uint32_t(palette >> 6) << 24;
+    const __m128i table = _mm_set1_epi32(int(shades));
+    const __m128i mask = _mm_set1_epi8(3);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i index = _mm_loadu_si128(reinterpret_cast<const __m128i*>(indices + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_shuffle_epi8(table, _mm_and_si128(index, mask)));
+    }
+    shadeScalar(indices + i, count - i, palette, out + i);
+}
+
+__attribute__((target("avx2")))
+static void decodeAVX2(const uint8_t *lo, const uint8_t *hi, size_t tiles, uint8_t *out) {
+    const __m256i bits = _mm256_set1_epi64x(int64_t(0x0102040810204080ull));
+    const __m256i one = _mm256_set1_epi8(1), two = _mm256_set1_epi8(2);
+    size_t t = 0;
+    for (; t + 8 <= tiles; t += 8) {
+        uint64_t lo8, hi8;
+        std::memcpy(&lo8, lo + t, sizeof(lo8));
+        std::memcpy(&hi8, hi + t, sizeof(hi8));
+        // All eight tiles in every 64 bit lane, so each 128 bit shuffle
+        // can reach any of them.
+        __m256i l = _mm256_set1_epi64x(int64_t(lo8));
+        __m256i h = _mm256_set1_epi64x(int64_t(hi8));
+        for (int quad = 0; quad < 2; ++quad) {
+            // Tiles 4 * quad to 4 * quad + 3, two per 128 bit lane.
+            const __m256i select = _mm256_add_epi8(
+                _mm256_set_epi8(3, 3, 3, 3, 3, 3, 3, 3, 2, 2, 2, 2, 2, 2, 2, 2,
+                                1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0),
+                _mm256_set1_epi8(char(4 * quad)));
+            __m256i lset = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(l, select), bits), bits);
+            __m256i hset = _mm256_cmpeq_epi8(_mm256_and_si256(_mm256_shuffle_epi8(h, select), bits), bits);
+            __m256i index = _mm256_or_si256(_mm256_and_si256(lset, one), _mm256_and_si256(hset, two));
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8 * t + 32 * quad), index);
+        }
+    }
+    decodeScalar(lo + t, hi + t, tiles - t, out + 8 * t);
+}
+
+__attribute__((target("avx2")))
+static void shadeAVX2(const uint8_t *indices, size_t count, uint8_t palette, uint8_t *out) {
+    uint32_t shades = (palette & 3) | (palette >> 2 & 3) << 8 | (palette >> 4 & 3) << 16 | uint32_t(palette >> 6) << 24;
+    const __m256i table = _mm256_set1_epi32(int(shades));
+    const __m256i mask = _mm256_set1_epi8(3);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i index = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(indices + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                            _mm256_shuffle_epi8(table, _mm256_and_si256(index, mask)));
+    }
+    shadeScalar(indices + i, count - i, palette, out + i);
+}
+#endif
+
+bool TileDecoder::supported(Kernel kernel) {
+    switch (kernel) {
+        case Kernel::Scalar: return true;
+#if GB_TILE_SIMD_X86
+        case Kernel::SSSE3: return __builtin_cpu_supports("ssse3");
+        case Kernel::AVX2: return __builtin_cpu_supports("avx2");
+#else
+        default: return false;
+#endif
+    }
+    return false;
+}
+
+TileDecoder::Kernel TileDecoder::best() {
+    if (supported(Kernel::AVX2)) return Kernel::AVX2;
+    if (supported(Kernel::SSSE3)) return Kernel::SSSE3;
+    return Kernel::Scalar;
+}
+
+const char *TileDecoder::name(Kernel kernel) {
+    switch (kernel) {
+        case Kernel::Scalar: return "scalar";
+        case Kernel::SSSE3: return "ssse3";
+        case Kernel::AVX2: return "avx2";
+    }
+    return "?";
+}
+
+TileDecoder::TileDecoder(Kernel kernel) : active(supported(kernel) ? kernel : Kernel::Scalar) {
+    decodeRow = decodeScalar;
+    shadeRow = shadeScalar;
+#if GB_TILE_SIMD_X86
+    if (active == Kernel::SSSE3) {
+        decodeRow = decodeSSSE3;
+        shadeRow = shadeSSSE3;
+    } else if (active == Kernel::AVX2) {
+        decodeRow = decodeAVX2;
+        shadeRow = shadeAVX2;
+    }
+#endif
+}
+
+size_t TileDecoder::mismatches(Kernel kernel) {
+    TileDecoder tested(kernel), scalar(Kernel::Scalar);
+    size_t differing = 0;
+
+    // Every lo/hi pair once, cut into runs of 1 to 40 tiles.
+    std::vector<uint8_t> lo(0x10000), hi(0x10000), got(8 * 40), want(8 * 40);
+    for (size_t i = 0; i < lo.size(); ++i) {
+        lo[i] = uint8_t(i);
+        hi[i] = uint8_t(i >> 8);
+    }
+    for (size_t at = 0, length = 1; at < lo.size(); at += length, length = length % 40 + 1) {
+        size_t tiles = std::min(length, lo.size() - at);
+        tested.decode(lo.data() + at, hi.data() + at, tiles, got.data());
+        scalar.decode(lo.data() + at, hi.data() + at, tiles, want.data());
+        for (size_t i = 0; i < 8 * tiles; ++i) differing += got[i] != want[i];
+    }
+
+    // Every palette over runs of 1 to 100 pseudo random bytes, so indices
+    // out of range are held to the same masking.
+    std::vector<uint8_t> indices(100);
+    got.resize(indices.size());
+    want.resize(indices.size());
+    uint32_t seed = 1;
+    for (unsigned palette = 0; palette < 256; ++palette) {
+        for (size_t count = 1; count <= indices.size(); ++count) {
+            for (uint8_t &index: indices) {
+                seed = seed * 1664525 + 1013904223;
+                index = uint8_t(seed >> 24);
+            }
+            tested.shade(indices.data(), count, uint8_t(palette), got.data());
+            scalar.shade(indices.data(), count, uint8_t(palette), want.data());
+            for (size_t i = 0; i < count; ++i) differing += got[i] != want[i];
+        }
+    }
+    return differing;
+}
@@ -0,0 +1,145 @@
+#include <state/Rewind.h>
+#include <state/SaveState.h>
+#include <utils/log.h>
+#include <cstring>
+
+constexpr const char *LOG_TAG = "GBREWIND";
+
+// A delta is a run of tokens: varint count of unchanged bytes, varint count
+// of changed bytes, then the XOR of those. A changed run only ends at eight
+// unchanged bytes, so short gaps do not cost a token each.
+static constexpr size_t GAP = 8;
+
+static uint8_t *putVarint(uint8_t *out, size_t value) {
+    while (value >= 0x80) {
+        *out++ = uint8_t(value) | 0x80;
+        value >>= 7;
+    }
+    *out++ = uint8_t(value);
+    return out;
+}
+
+static bool getVarint(const uint8_t *&in, const uint8_t *end, size_t &value) {
+    value = 0;
+    for (unsigned shift = 0; in < end && shift < 64; shift += 7) {
+        uint8_t byte = *in++;
+        value |= size_t(byte & 0x7F) << shift;
+        if (!(byte & 0x80)) return true;
+    }
+    return false;
+}
+
+static uint64_t load64(const uint8_t *at) {
+    uint64_t value;
+    std::memcpy(&value, at, sizeof(value));
+    return value;
+}
+
+size_t Rewind::encode(const uint8_t *a, const uint8_t *b, size_t size, uint8_t *out) {
+    uint8_t *start = out;
+    size_t at = 0;
+    while (at < size) {
+        size_t same = at;
+        while (at + 8 <= size && load64(a + at) == load64(b + at)) at += 8;
+        while (at < size && a[at] == b[at]) ++at;
+        if (at == size) break;
+        size_t changed = at;
+        size_t end = at;
+        for (size_t scan = at; scan < size && scan - end < GAP; ++scan) {
+            if (a[scan] != b[scan]) end = scan + 1;
+        }
+        out = putVarint(out, changed - same);
+        out = putVarint(out, end - changed);
+        for (; at < end; ++at) *out++ = a[at] ^ b[at];
+    }
+    return size_t(out - start);
+}
+
+bool Rewind::decode(const uint8_t *in, size_t length, uint8_t *state, size_t size) {
+    const uint8_t *end = in + length;
+    size_t at = 0;
+    while (in < end) {
+        size_t same, changed;
+        if (!getVarint(in, end, same) || !getVarint(in, end, changed)) return false;
+        if (same > size - at || changed > size - at - same || changed > size_t(end - in)) return false;
+        at += same;
+        for (size_t i = 0; i < changed; ++i) state[at++] ^= *in++;
+    }
+    return true;
+}
+
+Rewind::Rewind(size_t bufferBytes, size_t maxFrames) {
+    configure(bufferBytes, maxFrames);
+}
+
+void Rewind::configure(size_t bufferBytes, size_t maxFrames) {
+    ring.assign(bufferBytes, 0);
+    frameLimit = maxFrames;
+    clear();
+}
+
+void Rewind::clear() {
+    history.clear();
+    head = used = 0;
+    last.clear();
+}
+
+void Rewind::capture(const GBCPU &cpu, const GBMEM &mem) {
+    SaveState::save(cpu, mem, current);
+    if (last.size() == current.size()) {
+        scratch.resize(maxEncodedSize(current.size()));
+        store(scratch.data(), encode(last.data(), current.data(), current.size(), scratch.data()));
+    } else {
+        // First capture, or another game.
+        history.clear();
+        head = used = 0;
+    }
+    last.swap(current);
+}
+
+// Frames sit in the ring in capture order. The oldest are the ones right
+// after head, so making room only ever drops from the front.
+void Rewind::store(const uint8_t *delta, size_t size) {
+    if (size > ring.size()) {
+        LOG_E(LOG_TAG, "A %zu byte frame does not fit the %zu byte buffer", size, ring.size());
+        history.clear();
+        head = used = 0;
+        return;
+    }
+    if (head + size > ring.size()) {
+        // The tail end is too short; whatever is still there is the oldest.
+        while (!history.empty() && history.front().offset >= head) {
+            used -= history.front().size;
+            history.pop_front();
+        }
+        head = 0;
+    }
+    while (!history.empty() && history.front().offset >= head && history.front().offset < head + size) {
+        used -= history.front().size;
+        history.pop_front();
+    }
+    while (history.size() >= frameLimit && !history.empty()) {
+        used -= history.front().size;
+        history.pop_front();
+    }
+    if (!frameLimit) return;
+
+    std::memcpy(ring.data() + head, delta, size);
+    history.push_back({head, size});
+    head += size;
+    used += size;
+}
+
+bool Rewind::stepBack(GBCPU &cpu, GBMEM &mem) {
+    if (history.empty()) return false;
+    Frame frame = history.back();
+    history.pop_back();
+    head = frame.offset;
+    used -= frame.size;
+    if (!decode(ring.data() + frame.offset, frame.size, last.data(), last.size())) {
+        LOG_E(LOG_TAG, "Corrupt rewind frame, dropping the history");
+        clear();
+        return false;
+    }
+    return SaveState::load(cpu, mem, last);
+}
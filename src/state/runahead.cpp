@@ -0,0 +1,41 @@
+#include <state/RunAhead.h>
+#include <state/SaveState.h>
+#include <utils/log.h>
+#include <chrono>
+
+constexpr const char *LOG_TAG = "GBRUNAHEAD";
+
+// Weight of the newest frame in the running averages, which start at the
+// first one.
+static constexpr double SMOOTHING = 1.0 / 16;
+
+static void average(double &mean, double sample) {
+    mean = mean ? mean + (sample - mean) * SMOOTHING : sample;
+}
+
+static double since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+void RunAhead::setFrames(unsigned frames) {
+    if (frames == ahead) return;
+    ahead = frames;
+    lastExtra = averageExtra = 0;
+}
+
+bool RunAhead::runFrame(GBCPU &cpu, GBMEM &mem, FrameFn frame, void *context) {
+    auto start = std::chrono::steady_clock::now();
+    frame(context, ahead == 0, true);
+    double real = since(start);
+    average(averageFrame, real);
+    if (!ahead) return true;
+
+    start = std::chrono::steady_clock::now();
+    SaveState::save(cpu, mem, state);
+    for (unsigned i = 1; i <= ahead; ++i) frame(context, i == ahead, false);
+    bool restored = SaveState::load(cpu, mem, state);
+    lastExtra = since(start);
+    average(averageExtra, lastExtra);
+    if (!restored) LOG_E(LOG_TAG, "Could not return from %u frames ahead", ahead);
+    return restored;
+}
@@ -0,0 +1,130 @@
+#include <state/SaveState.h>
+#include <utils/log.h>
+#include <atomic>
+#include <cstring>
+
+constexpr const char *LOG_TAG = "GBSTATE";
+static constexpr char MAGIC[4] = {'G', 'B', 'S', 'T'};
+static constexpr char DELTA_MAGIC[4] = {'G', 'B', 'D', 'L'};
+
+// Unique within the process, so a delta cannot be applied to another base.
+static std::atomic<uint64_t> nextBase{1};
+
+static size_t indexBytes(size_t pages) {
+    return (pages * sizeof(uint16_t) + 7) & ~size_t(7);
+}
+
+static void writeHeader(SaveState::Header &header, const char (&magic)[4], size_t size, size_t memBytes,
+                        size_t ramBytes, uint64_t base) {
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = SaveState::VERSION;
+    header.size = uint32_t(size);
+    header.cpuBytes = sizeof(GBCPU::State);
+    header.memBytes = uint32_t(memBytes);
+    header.ramBytes = uint32_t(ramBytes);
+    header.reserved = 0;
+    header.base = base;
+}
+
+static bool checkHeader(const std::vector<uint8_t> &in, size_t fixedBytes, const char (&magic)[4],
+                        size_t memBytes, const GBMEM &mem, const char *what) {
+    if (in.size() < fixedBytes) {
+        LOG_E(LOG_TAG, "%s too short (%zu bytes)", what, in.size());
+        return false;
+    }
+    const SaveState::Header &header = *reinterpret_cast<const SaveState::Header*>(in.data());
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0 || header.version != SaveState::VERSION ||
+        header.size != in.size() || header.cpuBytes != sizeof(GBCPU::State) ||
+        header.memBytes != memBytes || header.ramBytes != mem.cartridge().ramSize()) {
+        LOG_E(LOG_TAG, "%s is not version %u for this build", what, SaveState::VERSION);
+        return false;
+    }
+    return true;
+}
+
+// Buffers come from operator new, which aligns them for the fixed part, so
+// the blocks are written in place rather than assembled and copied.
+void SaveState::save(const GBCPU &cpu, const GBMEM &mem, std::vector<uint8_t> &out) {
+    out.resize(size(mem));
+    Fixed *fixed = reinterpret_cast<Fixed*>(out.data());
+    writeHeader(fixed->header, MAGIC, out.size(), sizeof(GBMEM::State), mem.cartridge().ramSize(), 0);
+    cpu.saveState(fixed->cpu);
+    mem.saveState(fixed->mem, out.data() + sizeof(Fixed));
+}
+
+bool SaveState::load(GBCPU &cpu, GBMEM &mem, const std::vector<uint8_t> &in) {
+    if (!checkHeader(in, sizeof(Fixed), MAGIC, sizeof(GBMEM::State), mem, "State")) return false;
+    const Fixed *fixed = reinterpret_cast<const Fixed*>(in.data());
+    if (sizeof(Fixed) + fixed->header.ramBytes != in.size()) {
+        LOG_E(LOG_TAG, "Corrupt state");
+        return false;
+    }
+    if (!mem.loadState(fixed->mem, in.data() + sizeof(Fixed))) {
+        LOG_E(LOG_TAG, "State was saved with another game");
+        return false;
+    }
+    cpu.loadState(fixed->cpu);
+    // Back at the tracked base, nothing has been written since.
+    uint64_t base = fixed->header.base;
+    if (base && base == mem.trackedBase()) mem.trackWrites(base);
+    return true;
+}
+
+void SaveState::saveBase(const GBCPU &cpu, GBMEM &mem, std::vector<uint8_t> &out) {
+    save(cpu, mem, out);
+    uint64_t base = nextBase++;
+    reinterpret_cast<Fixed*>(out.data())->header.base = base;
+    mem.trackWrites(base);
+}
+
+void SaveState::saveDelta(const GBCPU &cpu, const GBMEM &mem, std::vector<uint8_t> &out) {
+    size_t pages = mem.writtenPages();
+    size_t indices = indexBytes(pages);
+    out.resize(sizeof(DeltaFixed) + indices + pages * GBMEM::STATE_PAGE_SIZE);
+    DeltaFixed *fixed = reinterpret_cast<DeltaFixed*>(out.data());
+    writeHeader(fixed->header, DELTA_MAGIC, out.size(), sizeof(GBMEM::DeltaState), mem.cartridge().ramSize(),
+                mem.trackedBase());
+    cpu.saveState(fixed->cpu);
+    fixed->pageCount = uint32_t(pages);
+    fixed->reserved = 0;
+    uint8_t *indexArea = out.data() + sizeof(DeltaFixed);
+    std::memset(indexArea, 0, indices);
+    mem.saveDelta(fixed->mem, reinterpret_cast<uint16_t*>(indexArea), indexArea + indices);
+}
+
+bool SaveState::loadDelta(GBCPU &cpu, GBMEM &mem, const std::vector<uint8_t> &base,
+                          const std::vector<uint8_t> &delta) {
+    if (!checkHeader(delta, sizeof(DeltaFixed), DELTA_MAGIC, sizeof(GBMEM::DeltaState), mem, "Delta")) return false;
+    if (!checkHeader(base, sizeof(Fixed), MAGIC, sizeof(GBMEM::State), mem, "Base")) return false;
+    const DeltaFixed *fixed = reinterpret_cast<const DeltaFixed*>(delta.data());
+    uint64_t baseId = reinterpret_cast<const Fixed*>(base.data())->header.base;
+    if (!fixed->header.base || fixed->header.base != baseId) {
+        LOG_E(LOG_TAG, "Delta does not belong to this base");
+        return false;
+    }
+    size_t pages = fixed->pageCount;
+    size_t indices = indexBytes(pages);
+    if (pages > mem.statePages() ||
+        sizeof(DeltaFixed) + indices + pages * GBMEM::STATE_PAGE_SIZE != delta.size()) {
+        LOG_E(LOG_TAG, "Corrupt delta");
+        return false;
+    }
+    const uint8_t *indexArea = delta.data() + sizeof(DeltaFixed);
+    const uint16_t *pageIndices = reinterpret_cast<const uint16_t*>(indexArea);
+    for (size_t i = 0; i < pages; ++i) {
+        if (pageIndices[i] >= mem.statePages()) {
+            LOG_E(LOG_TAG, "Corrupt delta");
+            return false;
+        }
+    }
+    if (!mem.cartridge().matches(fixed->mem.cart)) {
+        LOG_E(LOG_TAG, "Delta was saved with another game");
+        return false;
+    }
+
+    if (!load(cpu, mem, base)) return false;
+    mem.trackWrites(baseId);
+    mem.loadDelta(fixed->mem, pageIndices, indexArea + indices, pages);
+    cpu.loadState(fixed->cpu);
+    return true;
+}
@@ -0,0 +1,8 @@
+#include <utils/trace.h>
+
+void dumpTraceRecord(std::FILE *out, const TraceRecord &r) {
+    std::fprintf(out,
+                 "PC=%04X OP=%02X %02X %02X  AF=%04X BC=%04X DE=%04X HL=%04X SP=%04X\n",
+                 r.pc, r.opcode, r.operand[0], r.operand[1],
+                 r.af, r.bc, r.de, r.hl, r.sp);
+}